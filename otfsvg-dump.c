@@ -276,15 +276,83 @@ static bool popGroup(void* userdata, float opacity, otfsvg_blend_mode_t mode)
     return true;
 }
 
+static void dumpDocument(render_context_t* context, otfsvg_document_t* document, const otfsvg_rect_t* rect, const char* id, int glyph)
+{
+    if(id != NULL) {
+        openBranch(context, "element");
+        writeIndent(context);
+        writeF(context, "id : %s", id);
+        newLine(context);
+    } else if(glyph != -1) {
+        openBranch(context, "glyph");
+        writeIndent(context);
+        writeF(context, "id : %d", glyph);
+        newLine(context);
+    } else {
+        openBranch(context, "document");
+    }
+
+    writeIndent(context);
+    writeF(context, "rect : %g %g %g %g", rect->x, rect->y, rect->w, rect->h);
+    newLine(context);
+
+    otfsvg_canvas_t canvas = {writeFill, writeStroke, pushGroup, popGroup, NULL, NULL};
+    if(glyph == -1)
+        otfsvg_document_render(document, &canvas, context, NULL, NULL, otfsvg_black_color, id);
+    else
+        otfsvg_document_render_glyph(document, &canvas, context, NULL, NULL, otfsvg_black_color, glyph);
+
+    closeBranch(context);
+    newLine(context);
+}
+
+static int dumpFont(otfsvg_font_t* font, FILE* output, const char* input, const char* id)
+{
+    otfsvg_document_record_t record;
+    if(!otfsvg_font_document_at(font, 0, &record)) {
+        printf("Unable to locate a document in (%s)\n", input);
+        return -1;
+    }
+
+    int glyph = record.start_glyph;
+    if(id != NULL) {
+        char* end;
+        long value = strtol(id, &end, 10);
+        if(end == id || *end != '\0' || value < 0 || value > 65535) {
+            printf("Invalid glyph ID (%s)\n", id);
+            return -1;
+        }
+
+        glyph = (int)value;
+    }
+
+    otfsvg_rect_t rect = {0, 0, 0, 0};
+    otfsvg_document_t* document = otfsvg_font_load_document(font, glyph);
+    if(document == NULL || !otfsvg_document_rect_glyph(document, &rect, glyph)) {
+        printf("Unable to locate glyph (%d)\n", glyph);
+        return -1;
+    }
+
+    render_context_t context = {output, 0};
+    dumpDocument(&context, document, &rect, NULL, glyph);
+    return 0;
+}
+
 int main(int argc, char* argv[])
 {
     if(argc != 3 && argc != 4) {
         printf("Usage : otfsvg-dump input output [id]\n");
+        printf("        input may be an SVG document or a font, id is a glyph ID for fonts\n");
         return -1;
     }
 
-    FILE* input = fopen(argv[1], "r");
-    if(input == NULL) {
+    const char* id = NULL;
+    if(argc == 4)
+        id = argv[3];
+
+    otfsvg_font_t* font = otfsvg_font_load_from_file(argv[1]);
+    FILE* input = NULL;
+    if(font == NULL && (input = fopen(argv[1], "rb")) == NULL) {
         printf("Unable to open input file (%s)\n", argv[1]);
         return -1;
     }
@@ -292,10 +360,20 @@ int main(int argc, char* argv[])
     FILE* output = fopen(argv[2], "w");
     if(output == NULL) {
         printf("Unable to open output file (%s)\n", argv[2]);
-        fclose(input);
+        if(font)
+            otfsvg_font_destroy(font);
+        if(input)
+            fclose(input);
         return -1;
     }
 
+    if(font) {
+        int result = dumpFont(font, output, argv[1], id);
+        otfsvg_font_destroy(font);
+        fclose(output);
+        return result;
+    }
+
     fseek(input, 0, SEEK_END);
     size_t length = ftell(input);
     char* data = malloc(length);
@@ -310,10 +388,6 @@ int main(int argc, char* argv[])
         goto cleanup;
     }
 
-    const char* id = NULL;
-    if(argc == 4)
-        id = argv[3];
-
     otfsvg_rect_t rect = {0, 0, 0, 0};
     if(!otfsvg_document_rect(document, &rect, id)) {
         printf("Unable to locate (%s)\n", id);
@@ -321,24 +395,7 @@ int main(int argc, char* argv[])
     }
 
     render_context_t context = {output, 0};
-    if(id == NULL) {
-        openBranch(&context, "document");
-    } else {
-        openBranch(&context, "element");
-        writeIndent(&context);
-        writeF(&context, "id : %s", id);
-        newLine(&context);
-    }
-
-    writeIndent(&context);
-    writeF(&context, "rect : %g %g %g %g", rect.x, rect.y, rect.w, rect.h);
-    newLine(&context);
-
-    otfsvg_canvas_t canvas = {writeFill, writeStroke, pushGroup, popGroup, NULL, NULL};
-    otfsvg_document_render(document, &canvas, &context, NULL, NULL, otfsvg_black_color, id);
-
-    closeBranch(&context);
-    newLine(&context);
+    dumpDocument(&context, document, &rect, id, -1);
 
 cleanup:
     otfsvg_document_destory(document);
@@ -7,6 +7,46 @@
 #include <ctype.h>
 #include <assert.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define OTFSVG_SIMD_AVX2
+#define OTFSVG_SIMD_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OTFSVG_SIMD_SSE2
+#endif
+
+#if defined(OTFSVG_SIMD_SSE2) && defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+static inline int otfsvg_ctz(unsigned int value)
+{
+    unsigned long index;
+    _BitScanForward(&index, value);
+    return (int)(index);
+}
+#elif defined(OTFSVG_SIMD_SSE2)
+#define otfsvg_ctz(value) __builtin_ctz(value)
+#endif
+
+#if defined(_MSC_VER)
+#define otfsvg_noinline __declspec(noinline)
+#define otfsvg_forceinline __forceinline
+#elif defined(__GNUC__)
+#define otfsvg_noinline __attribute__((noinline))
+#define otfsvg_forceinline inline __attribute__((always_inline))
+#else
+#define otfsvg_noinline
+#define otfsvg_forceinline inline
+#endif
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #define otfsvg_sqrt2 1.41421356237309504880f
 #define otfsvg_pi 3.14159265358979323846f
 #define otfsvg_kappa 0.55228474983079339840f
@@ -506,12 +546,122 @@ static inline bool string_eq(const char* it, const char* end, const char* data)
     return false;
 }
 
+/*
+ * Returns the first occurrence of ch in [it, end), or end. Markup is scanned 32 or 16 bytes at a time when AVX2 or
+ * SSE2 is enabled at build time; the scalar loop handles the tail.
+ */
+static inline const char* scan_char(const char* it, const char* end, char ch)
+{
+#ifdef OTFSVG_SIMD_AVX2
+    const __m256i needle32 = _mm256_set1_epi8(ch);
+    while(end - it >= 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(it));
+        unsigned int mask = (unsigned int)(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle32)));
+        if(mask)
+            return it + otfsvg_ctz(mask);
+        it += 32;
+    }
+#endif
+#ifdef OTFSVG_SIMD_SSE2
+    const __m128i needle16 = _mm_set1_epi8(ch);
+    while(end - it >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(it));
+        unsigned int mask = (unsigned int)(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle16)));
+        if(mask)
+            return it + otfsvg_ctz(mask);
+        it += 16;
+    }
+#endif
+    while(it < end && *it != ch)
+        ++it;
+    return it;
+}
+
+/*
+ * Same as scan_char, but stops at the first occurrence of either character.
+ */
+static inline const char* scan_char2(const char* it, const char* end, char ch1, char ch2)
+{
+#ifdef OTFSVG_SIMD_AVX2
+    const __m256i first32 = _mm256_set1_epi8(ch1);
+    const __m256i second32 = _mm256_set1_epi8(ch2);
+    while(end - it >= 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(it));
+        __m256i match = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, first32), _mm256_cmpeq_epi8(chunk, second32));
+        unsigned int mask = (unsigned int)(_mm256_movemask_epi8(match));
+        if(mask)
+            return it + otfsvg_ctz(mask);
+        it += 32;
+    }
+#endif
+#ifdef OTFSVG_SIMD_SSE2
+    const __m128i first16 = _mm_set1_epi8(ch1);
+    const __m128i second16 = _mm_set1_epi8(ch2);
+    while(end - it >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(it));
+        __m128i match = _mm_or_si128(_mm_cmpeq_epi8(chunk, first16), _mm_cmpeq_epi8(chunk, second16));
+        unsigned int mask = (unsigned int)(_mm_movemask_epi8(match));
+        if(mask)
+            return it + otfsvg_ctz(mask);
+        it += 16;
+    }
+#endif
+    while(it < end && *it != ch1 && *it != ch2)
+        ++it;
+    return it;
+}
+
+/*
+ * Same as scan_char, but stops at the first occurrence of any of the three characters.
+ */
+static inline const char* scan_char3(const char* it, const char* end, char ch1, char ch2, char ch3)
+{
+#ifdef OTFSVG_SIMD_AVX2
+    const __m256i first32 = _mm256_set1_epi8(ch1);
+    const __m256i second32 = _mm256_set1_epi8(ch2);
+    const __m256i third32 = _mm256_set1_epi8(ch3);
+    while(end - it >= 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(it));
+        __m256i match = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, first32), _mm256_cmpeq_epi8(chunk, second32));
+        match = _mm256_or_si256(match, _mm256_cmpeq_epi8(chunk, third32));
+        unsigned int mask = (unsigned int)(_mm256_movemask_epi8(match));
+        if(mask)
+            return it + otfsvg_ctz(mask);
+        it += 32;
+    }
+#endif
+#ifdef OTFSVG_SIMD_SSE2
+    const __m128i first16 = _mm_set1_epi8(ch1);
+    const __m128i second16 = _mm_set1_epi8(ch2);
+    const __m128i third16 = _mm_set1_epi8(ch3);
+    while(end - it >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(it));
+        __m128i match = _mm_or_si128(_mm_cmpeq_epi8(chunk, first16), _mm_cmpeq_epi8(chunk, second16));
+        match = _mm_or_si128(match, _mm_cmpeq_epi8(chunk, third16));
+        unsigned int mask = (unsigned int)(_mm_movemask_epi8(match));
+        if(mask)
+            return it + otfsvg_ctz(mask);
+        it += 16;
+    }
+#endif
+    while(it < end && *it != ch1 && *it != ch2 && *it != ch3)
+        ++it;
+    return it;
+}
+
 static const char* string_find(const char* it, const char* end, const char* data)
 {
+    size_t length = strlen(data);
+    if(length == 0 || (size_t)(end - it) < length)
+        return (length == 0 && it < end) ? it : NULL;
+    const char last = data[length - 1];
+    it += length - 1;
     while(it < end) {
-        const char* begin = it;
-        if(skip_string(&it, end, data))
-            return begin;
+        it = scan_char(it, end, last);
+        if(it >= end)
+            break;
+        if(memcmp(it - (length - 1), data, length - 1) == 0)
+            return it - (length - 1);
         ++it;
     }
 
@@ -564,14 +714,26 @@ static inline bool skip_ws_comma(const char** begin, const char* end)
 
 typedef struct {
     const char* name;
+    size_t length;
     int id;
 } name_entry_t;
 
-static int name_entry_compare(const void* a, const void* b)
+/*
+ * Minimal perfect hash over the fixed name tables. The bucket picked by the hash holds a displacement that remixes
+ * the same hash so that every known name lands in its own slot; an unknown name lands on some entry and is rejected by
+ * the caller's length and memcmp check. The hash and slots arrays are generated by tools/namehash.py, which must be
+ * rerun whenever a table changes.
+ */
+static inline size_t name_slot(const char* data, size_t length, const uint8_t* hash, const uint8_t* slots, size_t count)
 {
-    const char* name = a;
-    const name_entry_t* entry = b;
-    return strcmp(name, entry->name);
+    uint32_t h = 0x811C9DC5u ^ (uint32_t)(length);
+    for(size_t i = 0; i < length; i++)
+        h = (h ^ (uint8_t)(data[i])) * 0x01000193u;
+    uint32_t x = h + hash[((uint64_t)(h) * count) >> 32] * 0x9E3779B1u;
+    x ^= x >> 15;
+    x *= 0x2C1B3C6Du;
+    x ^= x >> 12;
+    return slots[((uint64_t)(x) * count) >> 32];
 }
 
 enum {
@@ -624,76 +786,84 @@ enum {
     ID_XLINK_HREF,
     ID_Y,
     ID_Y1,
-    ID_Y2
+    ID_Y2,
+    ID_COUNT
 };
 
 static const name_entry_t propertymap[] = {
-    {"clip-path", ID_CLIP_PATH},
-    {"clip-rule", ID_CLIP_RULE},
-    {"clipPathUnits", ID_CLIP_PATH_UNITS},
-    {"color", ID_COLOR},
-    {"cx", ID_CX},
-    {"cy", ID_CY},
-    {"d", ID_D},
-    {"display", ID_DISPLAY},
-    {"fill", ID_FILL},
-    {"fill-opacity", ID_FILL_OPACITY},
-    {"fill-rule", ID_FILL_RULE},
-    {"fx", ID_FX},
-    {"fy", ID_FY},
-    {"gradientTransform", ID_GRADIENT_TRANSFORM},
-    {"gradientUnits", ID_GRADIENT_UNITS},
-    {"height", ID_HEIGHT},
-    {"id", ID_ID},
-    {"offset", ID_OFFSET},
-    {"opacity", ID_OPACITY},
-    {"overflow", ID_OVERFLOW},
-    {"points", ID_POINTS},
-    {"preserveAspectRatio", ID_PRESERVE_ASPECT_RATIO},
-    {"r", ID_R},
-    {"rx", ID_RX},
-    {"ry", ID_RY},
-    {"solid-color", ID_SOLID_COLOR},
-    {"solid-opacity", ID_SOLID_OPACITY},
-    {"spreadMethod", ID_SPREAD_METHOD},
-    {"stop-color", ID_STOP_COLOR},
-    {"stop-opacity", ID_STOP_OPACITY},
-    {"stroke", ID_STROKE},
-    {"stroke-dasharray", ID_STROKE_DASHARRAY},
-    {"stroke-dashoffset", ID_STROKE_DASHOFFSET},
-    {"stroke-linecap", ID_STROKE_LINECAP},
-    {"stroke-linejoin", ID_STROKE_LINEJOIN},
-    {"stroke-miterlimit", ID_STROKE_MITERLIMIT},
-    {"stroke-opacity", ID_STROKE_OPACITY},
-    {"stroke-width", ID_STROKE_WIDTH},
-    {"transform", ID_TRANSFORM},
-    {"viewBox", ID_VIEWBOX},
-    {"visibility", ID_VISIBILITY},
-    {"width", ID_WIDTH},
-    {"x", ID_X},
-    {"x1", ID_X1},
-    {"x2", ID_X2},
-    {"xlink:href", ID_XLINK_HREF},
-    {"y", ID_Y},
-    {"y1", ID_Y1},
-    {"y2", ID_Y2}
+    {"clip-path", 9, ID_CLIP_PATH},
+    {"clip-rule", 9, ID_CLIP_RULE},
+    {"clipPathUnits", 13, ID_CLIP_PATH_UNITS},
+    {"color", 5, ID_COLOR},
+    {"cx", 2, ID_CX},
+    {"cy", 2, ID_CY},
+    {"d", 1, ID_D},
+    {"display", 7, ID_DISPLAY},
+    {"fill", 4, ID_FILL},
+    {"fill-opacity", 12, ID_FILL_OPACITY},
+    {"fill-rule", 9, ID_FILL_RULE},
+    {"fx", 2, ID_FX},
+    {"fy", 2, ID_FY},
+    {"gradientTransform", 17, ID_GRADIENT_TRANSFORM},
+    {"gradientUnits", 13, ID_GRADIENT_UNITS},
+    {"height", 6, ID_HEIGHT},
+    {"id", 2, ID_ID},
+    {"offset", 6, ID_OFFSET},
+    {"opacity", 7, ID_OPACITY},
+    {"overflow", 8, ID_OVERFLOW},
+    {"points", 6, ID_POINTS},
+    {"preserveAspectRatio", 19, ID_PRESERVE_ASPECT_RATIO},
+    {"r", 1, ID_R},
+    {"rx", 2, ID_RX},
+    {"ry", 2, ID_RY},
+    {"solid-color", 11, ID_SOLID_COLOR},
+    {"solid-opacity", 13, ID_SOLID_OPACITY},
+    {"spreadMethod", 12, ID_SPREAD_METHOD},
+    {"stop-color", 10, ID_STOP_COLOR},
+    {"stop-opacity", 12, ID_STOP_OPACITY},
+    {"stroke", 6, ID_STROKE},
+    {"stroke-dasharray", 16, ID_STROKE_DASHARRAY},
+    {"stroke-dashoffset", 17, ID_STROKE_DASHOFFSET},
+    {"stroke-linecap", 14, ID_STROKE_LINECAP},
+    {"stroke-linejoin", 15, ID_STROKE_LINEJOIN},
+    {"stroke-miterlimit", 17, ID_STROKE_MITERLIMIT},
+    {"stroke-opacity", 14, ID_STROKE_OPACITY},
+    {"stroke-width", 12, ID_STROKE_WIDTH},
+    {"transform", 9, ID_TRANSFORM},
+    {"viewBox", 7, ID_VIEWBOX},
+    {"visibility", 10, ID_VISIBILITY},
+    {"width", 5, ID_WIDTH},
+    {"x", 1, ID_X},
+    {"x1", 2, ID_X1},
+    {"x2", 2, ID_X2},
+    {"xlink:href", 10, ID_XLINK_HREF},
+    {"y", 1, ID_Y},
+    {"y1", 2, ID_Y1},
+    {"y2", 2, ID_Y2}
+};
+
+/* Generated by tools/namehash.py from propertymap. */
+static const uint8_t propertyhash[49] = {
+    0, 0, 0, 0, 1, 3, 0, 1, 0, 0, 0, 0, 0, 0, 1, 0,
+    0, 0, 0, 4, 8, 2, 5, 1, 0, 0, 0, 2, 15, 8, 0, 0,
+    0, 0, 0, 0, 0, 0, 12, 0, 0, 6, 5, 0, 4, 3, 62, 20,
+    3
+};
+
+static const uint8_t propertyslots[49] = {
+    22, 0, 42, 48, 45, 6, 7, 25, 8, 41, 1, 40, 36, 24, 43, 11,
+    21, 32, 4, 15, 27, 47, 33, 39, 29, 28, 19, 34, 38, 44, 10, 46,
+    17, 30, 26, 37, 3, 2, 31, 12, 16, 18, 14, 13, 35, 23, 20, 9,
+    5
 };
 
 static int propertyid(const char* data, size_t length)
 {
-    if(length == 0 || length >= 24)
-        return ID_UNKNOWN;
-    char name[24];
-    for(int i = 0; i < length; i++)
-        name[i] = data[i];
-    name[length] = 0;
-
-    size_t count = sizeof(propertymap);
-    size_t size = sizeof(name_entry_t);
-    name_entry_t* entry = bsearch(name, propertymap, count / size, size, name_entry_compare);
-    if(entry == NULL)
-        return ID_UNKNOWN;
-    return entry->id;
+    size_t count = sizeof(propertymap) / sizeof(name_entry_t);
+    const name_entry_t* entry = &propertymap[name_slot(data, length, propertyhash, propertyslots, count)];
+    if(entry->length == length && memcmp(entry->name, data, length) == 0)
+        return entry->id;
+    return ID_UNKNOWN;
 }
 
 enum {
@@ -717,39 +887,40 @@ enum {
 };
 
 static const name_entry_t elementmap[] = {
-    {"circle", TAG_CIRCLE},
-    {"clipPath", TAG_CLIP_PATH},
-    {"defs", TAG_DEFS},
-    {"ellipse", TAG_ELLIPSE},
-    {"g", TAG_G},
-    {"line", TAG_LINE},
-    {"linearGradient", TAG_LINEAR_GRADIENT},
-    {"path", TAG_PATH},
-    {"polygon", TAG_POLYGON},
-    {"polyline", TAG_POLYLINE},
-    {"radialGradient", TAG_RADIAL_GRADIENT},
-    {"rect", TAG_RECT},
-    {"solidColor", TAG_SOLID_COLOR},
-    {"stop", TAG_STOP},
-    {"svg", TAG_SVG},
-    {"use", TAG_USE}
+    {"circle", 6, TAG_CIRCLE},
+    {"clipPath", 8, TAG_CLIP_PATH},
+    {"defs", 4, TAG_DEFS},
+    {"ellipse", 7, TAG_ELLIPSE},
+    {"g", 1, TAG_G},
+    {"line", 4, TAG_LINE},
+    {"linearGradient", 14, TAG_LINEAR_GRADIENT},
+    {"path", 4, TAG_PATH},
+    {"polygon", 7, TAG_POLYGON},
+    {"polyline", 8, TAG_POLYLINE},
+    {"radialGradient", 14, TAG_RADIAL_GRADIENT},
+    {"rect", 4, TAG_RECT},
+    {"solidColor", 10, TAG_SOLID_COLOR},
+    {"stop", 4, TAG_STOP},
+    {"svg", 3, TAG_SVG},
+    {"use", 3, TAG_USE}
+};
+
+/* Generated by tools/namehash.py from elementmap. */
+static const uint8_t elementhash[16] = {
+    0, 1, 0, 0, 1, 1, 0, 1, 2, 5, 1, 0, 0, 0, 0, 41
+};
+
+static const uint8_t elementslots[16] = {
+    7, 8, 5, 11, 10, 1, 13, 3, 0, 15, 14, 9, 6, 2, 4, 12
 };
 
 static int elementid(const char* data, size_t length)
 {
-    if(length == 0 || length >= 16)
-        return TAG_UNKNOWN;
-    char name[16];
-    for(int i = 0; i < length; i++)
-        name[i] = data[i];
-    name[length] = 0;
-
-    size_t count = sizeof(elementmap);
-    size_t size = sizeof(name_entry_t);
-    name_entry_t* entry = bsearch(name, elementmap, count / size, size, name_entry_compare);
-    if(entry == NULL)
-        return TAG_UNKNOWN;
-    return entry->id;
+    size_t count = sizeof(elementmap) / sizeof(name_entry_t);
+    const name_entry_t* entry = &elementmap[name_slot(data, length, elementhash, elementslots, count)];
+    if(entry->length == length && memcmp(entry->name, data, length) == 0)
+        return entry->id;
+    return TAG_UNKNOWN;
 }
 
 typedef struct {
@@ -757,95 +928,240 @@ typedef struct {
     size_t length;
 } string_t;
 
-typedef struct property {
-    int id;
-    string_t value;
-    struct property* next;
+typedef union typed_value typed_value_t;
+typedef struct style style_t;
+
+/*
+ * Each parsed subtree (the whole document, or one top-level child of a lazily loaded one) is stored as a single block:
+ * its elements in document order, then their properties, then the typed values of those properties. Links are 32-bit
+ * offsets relative to the record holding them, so a block needs no fixing up and its children are visited by skipping
+ * from one subtree end to the next. Property values are offsets into the document text. The computed style and the
+ * shape of an element are reached through 64-bit offsets relative to the element, and a shape stores its path right
+ * after itself, so a parsed document holds no pointer and can be copied into a shareable image as is.
+ */
+typedef struct {
+    uint32_t id;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t typed;
 } property_t;
 
-typedef struct element {
-    int id;
-    struct element* parent;
-    struct element* nextchild;
-    struct element* lastchild;
-    struct element* firstchild;
-    struct property* property;
+typedef struct {
+    otfsvg_rect_t bbox;
+    uint32_t commands;
+    uint32_t points;
+} shape_t;
+
+static_assert(ID_COUNT <= 64, "element_t.mask holds one bit per property id");
+
+typedef struct {
+    uint64_t mask;
+    int64_t style;
+    int64_t shape;
+    uint32_t parent;
+    uint32_t end;
+    uint32_t property;
+    uint16_t id;
+    uint16_t count;
 } element_t;
 
+typedef struct {
+    string_t name;
+    int element;
+    int slot;
+} element_id_t;
+
+static inline const style_t* element_style(const element_t* element)
+{
+    return (const style_t*)((intptr_t)(element) + element->style);
+}
+
+static inline const shape_t* element_shape(const element_t* element)
+{
+    if(element->shape == 0)
+        return NULL;
+    return (const shape_t*)((intptr_t)(element) + element->shape);
+}
+
+static inline void shape_path(const shape_t* shape, otfsvg_path_t* path)
+{
+    path->points.data = (otfsvg_point_t*)(shape + 1);
+    path->points.size = path->points.capacity = shape->points;
+    path->commands.data = (otfsvg_path_command_t*)(path->points.data + shape->points);
+    path->commands.size = path->commands.capacity = shape->commands;
+}
+
+static bool path_check(const otfsvg_path_command_t* commands, uint32_t count, uint32_t points)
+{
+    uint32_t required = 0;
+    for(uint32_t i = 0; i < count; i++) {
+        switch(commands[i]) {
+        case otfsvg_path_command_move_to:
+        case otfsvg_path_command_line_to:
+            required += 1;
+            break;
+        case otfsvg_path_command_cubic_to:
+            required += 3;
+            break;
+        case otfsvg_path_command_close:
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return required == points;
+}
+
+static inline size_t shape_size(const shape_t* shape)
+{
+    return sizeof(shape_t) + shape->points * sizeof(otfsvg_point_t) + shape->commands * sizeof(otfsvg_path_command_t);
+}
+
+/*
+ * The document heap is an arena: allocations are carved out of chunks that double in size up to HEAP_MAX_CHUNK_SIZE,
+ * and an allocation larger than half the current chunk size gets a chunk of its own, linked behind the current one so
+ * the space left in the current chunk is still used. Clearing the heap keeps the chunks for the next load, up to
+ * retainlimit bytes; the rest is returned to the system.
+ */
 typedef struct heap_chunk {
     struct heap_chunk* next;
+    size_t capacity;
 } heap_chunk_t;
 
 typedef struct {
     heap_chunk_t* chunk;
     heap_chunk_t* freedchunk;
     size_t size;
+    size_t chunksize;
+    size_t retained;
+    size_t retainlimit;
 } heap_t;
 
+#define HEAP_CHUNK_SIZE 4096
+#define HEAP_MAX_CHUNK_SIZE (256 * 1024)
+#define HEAP_RETAIN_LIMIT (1024 * 1024)
+#define ALIGN_SIZE(size) (((size) + 7ul) & ~7ul)
+
 static heap_t* heap_create(void)
 {
     heap_t* heap = malloc(sizeof(heap_t));
     heap->chunk = NULL;
     heap->freedchunk = NULL;
     heap->size = 0;
+    heap->chunksize = HEAP_CHUNK_SIZE;
+    heap->retained = 0;
+    heap->retainlimit = HEAP_RETAIN_LIMIT;
     return heap;
 }
 
-#define CHUNK_SIZE 4096
-#define ALIGN_SIZE(size) (((size) + 7ul) & ~7ul)
+/*
+ * Reuses the smallest retained chunk that fits, but never one more than twice the requested capacity, so a small
+ * request cannot pin a large chunk that the retention budget was meant to release.
+ */
+static heap_chunk_t* heap_take_chunk(heap_t* heap, size_t capacity)
+{
+    heap_chunk_t** best = NULL;
+    for(heap_chunk_t** p = &heap->freedchunk; *p; p = &(*p)->next) {
+        size_t size = (*p)->capacity;
+        if(size >= capacity && size / 2 <= capacity && (best == NULL || size < (*best)->capacity)) {
+            best = p;
+            if(size == capacity) {
+                break;
+            }
+        }
+    }
+
+    if(best) {
+        heap_chunk_t* chunk = *best;
+        *best = chunk->next;
+        heap->retained -= chunk->capacity;
+        return chunk;
+    }
+
+    heap_chunk_t* chunk = malloc(sizeof(heap_chunk_t) + capacity);
+    chunk->capacity = capacity;
+    return chunk;
+}
+
 static void* heap_alloc(heap_t* heap, size_t size)
 {
-    if(heap->chunk == NULL || heap->size + ALIGN_SIZE(size) > CHUNK_SIZE) {
-        heap_chunk_t* chunk = heap->freedchunk;
-        if(chunk == NULL) {
-            chunk = malloc(sizeof(heap_chunk_t) + CHUNK_SIZE);
-        } else {
-            heap->freedchunk = chunk->next;
+    size = ALIGN_SIZE(size);
+    if(heap->chunk == NULL || heap->size + size > heap->chunk->capacity) {
+        if(size > heap->chunksize / 2) {
+            heap_chunk_t* chunk = heap_take_chunk(heap, size);
+            if(heap->chunk == NULL) {
+                chunk->next = NULL;
+                heap->chunk = chunk;
+                heap->size = chunk->capacity;
+            } else {
+                chunk->next = heap->chunk->next;
+                heap->chunk->next = chunk;
+            }
+
+            return (char*)(chunk) + sizeof(heap_chunk_t);
         }
 
+        heap_chunk_t* chunk = heap_take_chunk(heap, heap->chunksize);
+        if(heap->chunksize < HEAP_MAX_CHUNK_SIZE)
+            heap->chunksize <<= 1;
         chunk->next = heap->chunk;
         heap->chunk = chunk;
         heap->size = 0;
     }
 
     void* data = (char*)(heap->chunk) + sizeof(heap_chunk_t) + heap->size;
-    heap->size += ALIGN_SIZE(size);
+    heap->size += size;
     return data;
 }
 
-static void heap_clear(heap_t* heap)
+static void heap_trim(heap_t* heap)
 {
-    heap->freedchunk = heap->chunk;
-    heap->chunk = NULL;
-    heap->size = 0;
+    heap_chunk_t** p = &heap->freedchunk;
+    while(*p && heap->retained > heap->retainlimit) {
+        heap_chunk_t* chunk = *p;
+        *p = chunk->next;
+        heap->retained -= chunk->capacity;
+        free(chunk);
+    }
 }
 
-static void heap_destroy(heap_t* heap)
+static void heap_clear(heap_t* heap)
 {
     while(heap->chunk) {
         heap_chunk_t* chunk = heap->chunk;
         heap->chunk = chunk->next;
-        free(chunk);
+        chunk->next = heap->freedchunk;
+        heap->freedchunk = chunk;
+        heap->retained += chunk->capacity;
     }
 
-    while(heap->freedchunk) {
-        heap_chunk_t* chunk = heap->freedchunk;
-        heap->freedchunk = chunk->next;
-        free(chunk);
-    }
+    heap->size = 0;
+    heap->chunksize = HEAP_CHUNK_SIZE;
+    heap_trim(heap);
+}
 
+static void heap_destroy(heap_t* heap)
+{
+    heap->retainlimit = 0;
+    heap_clear(heap);
     free(heap);
 }
 
-typedef struct hashmap_entry {
-    size_t hash;
-    string_t name;
+/*
+ * Open addressing with Robin Hood insertion: an entry that is further from its home slot than the one it probes
+ * takes that slot and the displaced entry continues, so a lookup stops as soon as it reaches an entry closer to home
+ * than itself. Entries are stored inline and keep a 32-bit hash, zero marking an empty slot.
+ */
+typedef struct {
+    const char* data;
+    uint32_t length;
+    uint32_t hash;
     void* value;
-    struct hashmap_entry* next;
 } hashmap_entry_t;
 
 typedef struct {
-    hashmap_entry_t** buckets;
+    hashmap_entry_t* entries;
     size_t size;
     size_t capacity;
 } hashmap_t;
@@ -853,30 +1169,69 @@ typedef struct {
 static hashmap_t* hashmap_create(void)
 {
     hashmap_t* map = malloc(sizeof(hashmap_t));
-    map->buckets = calloc(16, sizeof(hashmap_entry_t*));
+    map->entries = calloc(16, sizeof(hashmap_entry_t));
     map->size = 0;
     map->capacity = 16;
     return map;
 }
 
-static size_t hashmap_hash(const char* data, size_t length)
+static uint32_t hashmap_hash(const char* data, size_t length)
 {
-    size_t h = length;
-    for(int i = 0; i < length; i++) {
-        h = h * 31 + *data;
-        ++data;
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ length;
+    uint64_t chunk = 0;
+    if(length >= 8) {
+        const char* end = data + length - 8;
+        while(data < end) {
+            memcpy(&chunk, data, sizeof(chunk));
+            h = (h ^ chunk) * 0xff51afd7ed558ccdull;
+            h ^= h >> 32;
+            data += 8;
+        }
+
+        memcpy(&chunk, end, sizeof(chunk));
+    } else {
+        for(int i = 0; i < length; i++) {
+            chunk |= (uint64_t)((uint8_t)(data[i])) << (i * 8);
+        }
     }
 
+    h = (h ^ chunk) * 0xff51afd7ed558ccdull;
+    h ^= h >> 32;
+
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    uint32_t hash = (uint32_t)(h);
+    return hash ? hash : 1;
+}
+
+static uint64_t content_hash(const char* data, size_t length)
+{
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ length;
+    uint64_t chunk = 0;
+    size_t i = 0;
+    for(; i + 8 <= length; i += 8) {
+        memcpy(&chunk, data + i, sizeof(chunk));
+        h = (h ^ chunk) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+
+    chunk = 0;
+    for(; i < length; i++)
+        chunk = chunk << 8 | (uint8_t)(data[i]);
+    h = (h ^ chunk) * 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
     return h;
 }
 
-static bool hashmap_eq(const hashmap_entry_t* entry, const char* data, size_t length)
+static inline bool hashmap_eq(const hashmap_entry_t* entry, uint32_t hash, const char* data, size_t length)
 {
-    const string_t* name = &entry->name;
-    if(name->length != length)
+    if(entry->hash != hash || entry->length != length)
         return false;
     for(int i = 0; i < length; i++) {
-        if(data[i] != name->data[i]) {
+        if(data[i] != entry->data[i]) {
             return false;
         }
     }
@@ -884,215 +1239,727 @@ static bool hashmap_eq(const hashmap_entry_t* entry, const char* data, size_t le
     return true;
 }
 
-static void hashmap_expand(hashmap_t* map)
+static void hashmap_insert(hashmap_t* map, hashmap_entry_t entry)
 {
-    if(map->size > (map->capacity * 3 / 4)) {
-        size_t newcapacity = map->capacity << 1;
-        hashmap_entry_t** newbuckets = calloc(newcapacity, sizeof(hashmap_entry_t*));
-        for(int i = 0; i < map->capacity; i++) {
-            hashmap_entry_t* entry = map->buckets[i];
-            while(entry) {
-                hashmap_entry_t* next = entry->next;
-                size_t index = entry->hash & (newcapacity - 1);
-                entry->next = newbuckets[index];
-                newbuckets[index] = entry;
-                entry = next;
-            }
+    size_t mask = map->capacity - 1;
+    size_t index = entry.hash & mask;
+    size_t distance = 0;
+    bool displaced = false;
+    while(true) {
+        hashmap_entry_t* current = &map->entries[index];
+        if(current->hash == 0) {
+            *current = entry;
+            map->size += 1;
+            return;
+        }
+
+        if(!displaced && hashmap_eq(current, entry.hash, entry.data, entry.length)) {
+            current->value = entry.value;
+            return;
+        }
+
+        size_t current_distance = (index - current->hash) & mask;
+        if(current_distance < distance) {
+            hashmap_entry_t swap = *current;
+            *current = entry;
+            entry = swap;
+            distance = current_distance;
+            displaced = true;
         }
 
-        free(map->buckets);
-        map->buckets = newbuckets;
-        map->capacity = newcapacity;
+        index = (index + 1) & mask;
+        distance += 1;
     }
 }
 
-static void hashmap_put(hashmap_t* map, heap_t* heap, const char* data, size_t length, void* value)
+static void hashmap_reserve(hashmap_t* map, size_t count)
 {
-    size_t hash = hashmap_hash(data, length);
-    size_t index = hash & (map->capacity - 1);
-
-    hashmap_entry_t** p = &map->buckets[index];
-    while(true) {
-        hashmap_entry_t* current = *p;
-        if(current == NULL) {
-            hashmap_entry_t* entry = heap_alloc(heap, sizeof(hashmap_entry_t));
-            entry->name.data = data;
-            entry->name.length = length;
-            entry->hash = hash;
-            entry->value = value;
-            entry->next = NULL;
-            *p = entry;
-            map->size += 1;
-            hashmap_expand(map);
-            break;
+    size_t size = map->size + count;
+    if(size <= (map->capacity * 3 / 4))
+        return;
+    size_t newcapacity = map->capacity;
+    while(size > (newcapacity * 3 / 4))
+        newcapacity <<= 1;
+    hashmap_entry_t* entries = map->entries;
+    size_t capacity = map->capacity;
+    map->entries = calloc(newcapacity, sizeof(hashmap_entry_t));
+    map->capacity = newcapacity;
+    map->size = 0;
+    for(size_t i = 0; i < capacity; i++) {
+        if(entries[i].hash) {
+            hashmap_insert(map, entries[i]);
         }
+    }
 
-        if(current->hash == hash && hashmap_eq(current, data, length)) {
-            current->value = value;
-            break;
-        }
+    free(entries);
+}
 
-        p = &current->next;
+static hashmap_entry_t* hashmap_find(const hashmap_t* map, uint32_t hash, const char* data, size_t length)
+{
+    size_t mask = map->capacity - 1;
+    size_t index = hash & mask;
+    for(size_t distance = 0; true; distance++) {
+        hashmap_entry_t* entry = &map->entries[index];
+        if(hashmap_eq(entry, hash, data, length))
+            return entry;
+        if(entry->hash == 0 || ((index - entry->hash) & mask) < distance)
+            return NULL;
+        index = (index + 1) & mask;
     }
 }
 
-static void* hashmap_get(const hashmap_t* map, const char* data, size_t length)
+/*
+ * Updating the value of a key already present never resizes the map, so it does not move entries under concurrent
+ * readers.
+ */
+static void hashmap_put(hashmap_t* map, const char* data, size_t length, void* value)
 {
-    size_t hash = hashmap_hash(data, length);
-    size_t index = hash & (map->capacity - 1);
-
-    hashmap_entry_t* entry = map->buckets[index];
-    while(entry) {
-        if(entry->hash == hash && hashmap_eq(entry, data, length))
-            return entry->value;
-        entry = entry->next;
+    hashmap_entry_t entry = {data, (uint32_t)(length), hashmap_hash(data, length), value};
+    hashmap_entry_t* current = hashmap_find(map, entry.hash, data, length);
+    if(current) {
+        current->value = value;
+        return;
     }
 
-    return NULL;
+    hashmap_reserve(map, 1);
+    hashmap_insert(map, entry);
+}
+
+static void* hashmap_get(const hashmap_t* map, const char* data, size_t length)
+{
+    const hashmap_entry_t* entry = hashmap_find(map, hashmap_hash(data, length), data, length);
+    return entry ? entry->value : NULL;
 }
 
 static void hashmap_clear(hashmap_t* map)
 {
-    memset(map->buckets, 0, map->capacity * sizeof(hashmap_entry_t*));
+    memset(map->entries, 0, map->capacity * sizeof(hashmap_entry_t));
     map->size = 0;
 }
 
 static void hashmap_destroy(hashmap_t* map)
 {
-    free(map->buckets);
+    free(map->entries);
     free(map);
 }
 
+typedef struct {
+    char* data;
+    size_t capacity;
+} inflate_buffer_t;
+
+typedef struct {
+    element_t* element;
+    int slot;
+} glyph_t;
+
+typedef struct {
+    const char* begin;
+    const char* end;
+    element_t* element;
+    int state;
+} lazy_slot_t;
+
+enum {
+    lazy_state_unloaded,
+    lazy_state_queued,
+    lazy_state_loaded
+};
+
+typedef struct {
+    struct {
+        lazy_slot_t* data;
+        int size;
+        int capacity;
+    } slots;
+    struct {
+        int* data;
+        int size;
+        int capacity;
+    } queue;
+    hashmap_t* ids;
+    int current;
+    int complete;
+#ifndef _WIN32
+    pthread_mutex_t mutex;
+#endif
+} lazy_t;
+
 struct otfsvg_document {
     element_t* root;
+    const char* source;
+    size_t sourcelength;
+    const char* image;
+    void* mapping;
+    size_t mappinglength;
     hashmap_t* idcache;
     heap_t* heap;
+    lazy_t* lazy;
+    struct {
+        element_t* data;
+        int size;
+        int capacity;
+    } elements;
+    struct {
+        property_t* data;
+        int size;
+        int capacity;
+    } properties;
+    struct {
+        typed_value_t* data;
+        int size;
+        int capacity;
+    } values;
+    struct {
+        element_id_t* data;
+        int size;
+        int capacity;
+    } ids;
+    otfsvg_render_context_t* context;
+    otfsvg_matrix_t matrix;
+    otfsvg_path_t path;
+    struct {
+        glyph_t* data;
+        int size;
+        int capacity;
+    } glyphs;
+    int glyphbase;
+    inflate_buffer_t inflated;
+    float width;
+    float height;
+    float dpi;
+};
+
+typedef struct parent_override {
+    const element_t* element;
+    const element_t* parent;
+    const struct parent_override* next;
+} parent_override_t;
+
+typedef struct color_source color_source_t;
+typedef struct isolation isolation_t;
+
+struct otfsvg_render_context {
+    const otfsvg_document_t* document;
     otfsvg_canvas_t* canvas;
     void* canvas_data;
     otfsvg_palette_func_t palette_func;
     void* palette_data;
-    otfsvg_path_t path;
+    otfsvg_color_t current_color;
     otfsvg_paint_t paint;
+    struct {
+        color_source_t* data;
+        int size;
+        int capacity;
+    } sources;
     otfsvg_stroke_data_t strokedata;
-    otfsvg_matrix_t matrix;
-    otfsvg_color_t current_color;
-    float width;
-    float height;
-    float dpi;
+    const parent_override_t* overrides;
+    otfsvg_display_list_t* recorder;
+    const otfsvg_rect_t* clip;
+    isolation_t* isolation;
+    otfsvg_render_stats_t stats;
 };
 
-static inline const string_t* find_property(element_t* element, int id, bool inherit)
+/*
+ * The top-level children of a lazily loaded document live in blocks of their own, so a block root other than the
+ * document root has the document root as its parent.
+ */
+static inline const element_t* element_parent(const otfsvg_document_t* document, const element_t* element)
 {
-    do {
-        const property_t* property = element->property;
-        while(property != NULL) {
-            if(property->id == id)
-                return &property->value;
-            property = property->next;
-        }
-
-        element = element->parent;
-    } while(inherit && element);
-    return NULL;
+    if(element->parent > 0)
+        return element - element->parent;
+    return element == document->root ? NULL : document->root;
 }
 
-static inline bool has_property(element_t* element, int id)
+static inline const element_t* context_parent(const otfsvg_render_context_t* context, const element_t* element)
 {
-    const property_t* property = element->property;
-    while(property != NULL) {
-        if(property->id == id)
-            return true;
-        property = property->next;
+    const parent_override_t* override = context->overrides;
+    while(override) {
+        if(override->element == element)
+            return override->parent;
+        override = override->next;
     }
 
-    return false;
+    return element_parent(context->document, element);
 }
 
-static inline bool parse_float(const char** begin, const char* end, float* number)
+static inline bool has_children(const otfsvg_document_t* document, const element_t* element)
 {
-    const char* it = *begin;
-    float fraction = 0;
-    float integer = 0;
-    float exponent = 0;
-    int sign = 1;
-    int expsign = 1;
+    return element->end > 1 || (element == document->root && document->lazy->slots.size > 0);
+}
 
-    if(it < end && *it == '+')
-        ++it;
-    else if(it < end && *it == '-') {
-        ++it;
-        sign = -1;
-    }
+static inline const property_t* element_properties(const element_t* element)
+{
+    return (const property_t*)((const char*)(element) + element->property);
+}
 
-    if(it >= end || (!IS_NUM(*it) && *it != '.'))
+static inline bool has_property(const element_t* element, uint32_t id)
+{
+    return element->mask & (1ull << id);
+}
+
+static inline const property_t* find_property_entry(const element_t* element, uint32_t id)
+{
+    if(!has_property(element, id))
+        return NULL;
+    const property_t* property = element_properties(element);
+    while(property->id != id)
+        ++property;
+    return property;
+}
+
+static inline bool find_property(const otfsvg_document_t* document, const element_t* element, int id, string_t* value)
+{
+    const property_t* property = find_property_entry(element, id);
+    if(property == NULL)
         return false;
+    value->data = document->source + property->offset;
+    value->length = property->length;
+    return true;
+}
+
+/*
+ * Decimal to float conversion. Digits are accumulated into a 64-bit mantissa, eight at a time when they are contiguous.
+ * A mantissa and power of ten that are both exact in single precision are converted with one float operation; otherwise
+ * up to 19 significant digits with a power of ten that is exact in double precision are converted with one double
+ * operation (Clinger's fast path), and rounding that double to float is exact unless it lands on a halfway point between
+ * two floats. Those ties, long mantissas and large exponents are settled by comparing the decimal against the halfway
+ * points with big integers, so the result is always correctly rounded.
+ */
+#if (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) || defined(_M_X64) || defined(_M_IX86) || defined(_M_ARM64)
+#define OTFSVG_SWAR_DIGITS
+#endif
+
+#define DECIMAL_MANTISSA_DIGITS 19
+#define DECIMAL_EXACT_DIGITS 128
+#define BIGINT_LIMBS 48
+
+static const float pow10f_table[] = {
+    1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+};
+
+static const double pow10_table[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+typedef struct {
+    uint32_t limbs[BIGINT_LIMBS];
+    int size;
+} bigint_t;
 
-    if(*it != '.') {
-        while(*it && IS_NUM(*it))
-            integer = 10.f * integer + (*it++ - '0');
+static void bigint_init(bigint_t* big, uint32_t value)
+{
+    big->limbs[0] = value;
+    big->size = value ? 1 : 0;
+}
+
+static void bigint_mul_add(bigint_t* big, uint32_t factor, uint32_t addend)
+{
+    uint64_t carry = addend;
+    for(int i = 0; i < big->size; i++) {
+        uint64_t product = (uint64_t)(big->limbs[i]) * factor + carry;
+        big->limbs[i] = (uint32_t)(product);
+        carry = product >> 32;
     }
 
-    if(it < end && *it == '.') {
-        ++it;
-        if(it >= end || !IS_NUM(*it))
-            return false;
-        float div = 1.f;
-        while(it < end && IS_NUM(*it)) {
-            fraction = 10.f * fraction + (*it++ - '0');
-            div *= 10.f;
-        }
+    if(carry) {
+        assert(big->size < BIGINT_LIMBS);
+        big->limbs[big->size++] = (uint32_t)(carry);
+    }
+}
 
-        fraction /= div;
+static void bigint_mul_pow5(bigint_t* big, int exponent)
+{
+    while(exponent >= 13) {
+        bigint_mul_add(big, 1220703125, 0);
+        exponent -= 13;
     }
 
-    if(it < end && (*it == 'e' || *it == 'E') && (it[1] != 'x' && it[1] != 'm')) {
-        ++it;
-        if(it < end && *it == '+')
-            ++it;
-        else if(it < end && *it == '-') {
-            ++it;
-            expsign = -1;
-        }
+    uint32_t factor = 1;
+    while(exponent-- > 0)
+        factor *= 5;
+    bigint_mul_add(big, factor, 0);
+}
 
-        if(it >= end || !IS_NUM(*it))
-            return false;
+static void bigint_shift_left(bigint_t* big, int shift)
+{
+    if(big->size == 0 || shift == 0)
+        return;
+    int words = shift / 32;
+    int bits = shift % 32;
+    assert(big->size + words + 1 <= BIGINT_LIMBS);
+    big->limbs[big->size + words] = 0;
+    for(int i = big->size - 1; i >= 0; i--) {
+        uint32_t limb = big->limbs[i];
+        if(bits)
+            big->limbs[i + words + 1] |= limb >> (32 - bits);
+        big->limbs[i + words] = limb << bits;
+    }
 
-        while(it < end && IS_NUM(*it))
-            exponent = 10 * exponent + (*it++ - '0');
+    for(int i = 0; i < words; i++)
+        big->limbs[i] = 0;
+    big->size += words + 1;
+    while(big->size > 0 && big->limbs[big->size - 1] == 0) {
+        big->size--;
     }
+}
 
-    *begin = it;
-    *number = sign * (integer + fraction);
-    if(exponent)
-        *number *= powf(10.f, expsign * exponent);
-    return *number >= -FLT_MAX && *number <= FLT_MAX;
+static int bigint_compare(const bigint_t* a, const bigint_t* b)
+{
+    if(a->size != b->size)
+        return a->size < b->size ? -1 : 1;
+    for(int i = a->size - 1; i >= 0; i--) {
+        if(a->limbs[i] != b->limbs[i]) {
+            return a->limbs[i] < b->limbs[i] ? -1 : 1;
+        }
+    }
+
+    return 0;
 }
 
-static bool parse_number(element_t* element, int id, float* number, bool percent, bool inherit)
+/*
+ * Compares digits * 10^exponent (plus an infinitesimal when sticky) with halfway * 2^scale.
+ */
+static int decimal_compare(const char* digits, int count, int exponent, bool sticky, uint32_t halfway, int scale)
 {
-    const string_t* value = find_property(element, id, inherit);
-    if(value == NULL)
-        return false;
+    bigint_t a;
+    bigint_t b;
+    bigint_init(&a, 0);
+    for(int i = 0; i < count; i += 9) {
+        uint32_t chunk = 0;
+        uint32_t factor = 1;
+        for(int j = i; j < count && j < i + 9; j++) {
+            chunk = chunk * 10 + (digits[j] - '0');
+            factor *= 10;
+        }
 
-    const char* it = value->data;
-    const char* end = it + value->length;
-    if(!parse_float(&it, end, number))
-        return false;
+        if(a.size == 0) {
+            bigint_init(&a, chunk);
+        } else {
+            bigint_mul_add(&a, factor, chunk);
+        }
+    }
 
-    if(percent) {
-        if(skip_delim(&it, end, '%'))
-            *number /= 100.f;
-        *number = otfsvg_clamp(*number, 0.f, 1.f);
+    bigint_init(&b, halfway);
+    if(exponent >= 0) {
+        bigint_mul_pow5(&a, exponent);
+    } else {
+        bigint_mul_pow5(&b, -exponent);
     }
 
-    return true;
+    if(exponent > scale) {
+        bigint_shift_left(&a, exponent - scale);
+    } else {
+        bigint_shift_left(&b, scale - exponent);
+    }
+
+    int result = bigint_compare(&a, &b);
+    if(result == 0 && sticky)
+        return 1;
+    return result;
 }
 
-typedef enum {
-    length_type_unknown,
-    length_type_percent,
-    length_type_number,
-    length_type_px,
+static float decimal_to_float_exact(const char* integer, const char* integer_end, const char* fraction, const char* fraction_end, int exponent)
+{
+    char digits[DECIMAL_EXACT_DIGITS];
+    int count = 0;
+    bool sticky = false;
+    for(const char* it = integer; it < integer_end; ++it) {
+        if(count == 0 && *it == '0')
+            continue;
+        if(count < DECIMAL_EXACT_DIGITS) {
+            digits[count++] = *it;
+        } else {
+            sticky |= *it != '0';
+            exponent += 1;
+        }
+    }
+
+    for(const char* it = fraction; it < fraction_end; ++it) {
+        if(count == 0 && *it == '0') {
+            exponent -= 1;
+        } else if(count < DECIMAL_EXACT_DIGITS) {
+            digits[count++] = *it;
+            exponent -= 1;
+        } else {
+            sticky |= *it != '0';
+        }
+    }
+
+    if(count == 0 || count + exponent < -46)
+        return 0.f;
+    if(count - 1 + exponent > 38)
+        return INFINITY;
+
+    uint64_t mantissa = 0;
+    int head = otfsvg_min(count, DECIMAL_MANTISSA_DIGITS);
+    for(int i = 0; i < head; i++)
+        mantissa = mantissa * 10 + (digits[i] - '0');
+    float value = (float)((double)(mantissa) * pow(10.0, exponent + count - head));
+
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bits = otfsvg_min(bits, 0x7F7FFFFF);
+    while(bits < 0x7F800000) {
+        uint32_t biased = bits >> 23;
+        uint32_t significand = bits & 0x7FFFFF;
+        int scale = -149;
+        if(biased) {
+            significand |= 0x800000;
+            scale = biased - 150;
+        }
+
+        int above = decimal_compare(digits, count, exponent, sticky, 2 * significand + 1, scale - 1);
+        if(above > 0 || (above == 0 && (bits & 1))) {
+            bits += 1;
+            continue;
+        }
+
+        if(bits == 0)
+            break;
+        int below;
+        if(biased > 1 && significand == 0x800000) {
+            below = decimal_compare(digits, count, exponent, sticky, 4 * significand - 1, scale - 2);
+        } else {
+            below = decimal_compare(digits, count, exponent, sticky, 2 * significand - 1, scale - 1);
+        }
+
+        if(below < 0 || (below == 0 && (bits & 1))) {
+            bits -= 1;
+            continue;
+        }
+
+        break;
+    }
+
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static inline bool is_float_halfway(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if(bits & 0x0FFFFFFF)
+        return false;
+    int exponent = (int)((bits >> 52) & 0x7FF) - 1023;
+    int dropped = 29;
+    if(exponent < -126)
+        dropped += -126 - exponent;
+    if(dropped > 53)
+        return false;
+    uint64_t significand = (bits & ((1ull << 52) - 1)) | (1ull << 52);
+    return (significand & ((1ull << dropped) - 1)) == (1ull << (dropped - 1));
+}
+
+#ifdef OTFSVG_SWAR_DIGITS
+static inline bool is_eight_digits(const char* it)
+{
+    uint64_t chunk;
+    memcpy(&chunk, it, sizeof(chunk));
+    return ((chunk & 0xF0F0F0F0F0F0F0F0ull) | (((chunk + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) == 0x3333333333333333ull;
+}
+
+static inline bool parse_eight_digits(const char* it, uint32_t* value)
+{
+    if(!is_eight_digits(it))
+        return false;
+    uint64_t chunk;
+    memcpy(&chunk, it, sizeof(chunk));
+    chunk -= 0x3030303030303030ull;
+    chunk = (chunk * 10) + (chunk >> 8);
+    chunk = (((chunk & 0x000000FF000000FFull) * (100 + (1000000ull << 32)))
+        + (((chunk >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+    *value = (uint32_t)(chunk);
+    return true;
+}
+#endif
+
+static inline bool parse_exponent(const char** begin, const char* end, int* exponent)
+{
+    const char* it = *begin;
+    *exponent = 0;
+    if(it < end && (*it == 'e' || *it == 'E') && (it + 1 >= end || (it[1] != 'x' && it[1] != 'm'))) {
+        ++it;
+        int sign = 1;
+        if(it < end && *it == '+')
+            ++it;
+        else if(it < end && *it == '-') {
+            ++it;
+            sign = -1;
+        }
+
+        if(it >= end || !IS_NUM(*it))
+            return false;
+
+        int value = 0;
+        while(it < end && IS_NUM(*it)) {
+            if(value < 100000)
+                value = 10 * value + (*it - '0');
+            ++it;
+        }
+
+        *exponent = sign * value;
+    }
+
+    *begin = it;
+    return true;
+}
+
+/*
+ * Slow path of parse_float, entered only for a number the fast path has already validated: scans it again for the
+ * digit runs and the exponent and converts it exactly. Keeping the fast path free of that state lets it stay small.
+ */
+static otfsvg_noinline bool parse_float_exact(const char** begin, const char* end, float* number)
+{
+    const char* it = *begin;
+    bool negative = *it == '-';
+    if(*it == '+' || *it == '-')
+        ++it;
+    const char* integer = it;
+    while(it < end && IS_NUM(*it))
+        ++it;
+    const char* integer_end = it;
+    const char* fraction = it;
+    if(it < end && *it == '.') {
+        fraction = ++it;
+        while(it < end && IS_NUM(*it)) {
+            ++it;
+        }
+    }
+
+    const char* fraction_end = it;
+    int exponent = 0;
+    parse_exponent(&it, end, &exponent);
+
+    float value = decimal_to_float_exact(integer, integer_end, fraction, fraction_end, exponent);
+    *begin = it;
+    *number = negative ? -value : value;
+    return *number >= -FLT_MAX && *number <= FLT_MAX;
+}
+
+static bool parse_float_long(const char** begin, const char* end, float* number);
+
+static otfsvg_forceinline bool parse_decimal(const char** begin, const char* end, float* number, bool swar)
+{
+    const char* it = *begin;
+    bool negative = false;
+    if(it < end && *it == '+')
+        ++it;
+    else if(it < end && *it == '-') {
+        ++it;
+        negative = true;
+    }
+
+    if(it >= end || (!IS_NUM(*it) && *it != '.'))
+        return false;
+
+    uint64_t mantissa = 0;
+    const char* digits = it;
+    while(it < end && IS_NUM(*it))
+        mantissa = 10 * mantissa + (*it++ - '0');
+
+    int scale = 0;
+    int count = (int)(it - digits);
+    if(it < end && *it == '.') {
+        ++it;
+        if(it >= end || !IS_NUM(*it))
+            return false;
+        const char* fraction = it;
+#ifdef OTFSVG_SWAR_DIGITS
+        if(swar) {
+            uint32_t chunk;
+            while(end - it >= 8 && parse_eight_digits(it, &chunk)) {
+                mantissa = 100000000 * mantissa + chunk;
+                it += 8;
+            }
+        } else if(end - it >= 8 && IS_NUM(it[7]) && is_eight_digits(it)) {
+            return parse_float_long(begin, end, number);
+        }
+#else
+        (void)swar;
+#endif
+        while(it < end && IS_NUM(*it)) {
+            mantissa = 10 * mantissa + (*it++ - '0');
+        }
+
+        scale = -(int)(it - fraction);
+        count -= scale;
+    }
+
+    if(it < end && (*it == 'e' || *it == 'E')) {
+        int exponent = 0;
+        if(!parse_exponent(&it, end, &exponent))
+            return false;
+        scale += exponent;
+    }
+
+    if(count <= DECIMAL_MANTISSA_DIGITS && mantissa <= (1ull << 24) && scale >= -10 && scale <= 10) {
+        float value = (float)(mantissa);
+        if(scale < 0) {
+            value /= pow10f_table[-scale];
+        } else {
+            value *= pow10f_table[scale];
+        }
+
+        *begin = it;
+        *number = negative ? -value : value;
+        return true;
+    }
+
+    if(count <= DECIMAL_MANTISSA_DIGITS && mantissa <= (1ull << 53) && scale >= -22 && scale <= 22) {
+        double approx = (double)(mantissa);
+        if(scale < 0) {
+            approx /= pow10_table[-scale];
+        } else {
+            approx *= pow10_table[scale];
+        }
+
+        if(!is_float_halfway(approx)) {
+            float value = (float)(approx);
+            *begin = it;
+            *number = negative ? -value : value;
+            return *number >= -FLT_MAX && *number <= FLT_MAX;
+        }
+    }
+
+    return parse_float_exact(begin, end, number);
+}
+
+/* Long fractions take an out-of-line copy that consumes eight digits at a
+ * time, so the SWAR constants stay out of the common short-number path. */
+static otfsvg_noinline bool parse_float_long(const char** begin, const char* end, float* number)
+{
+    return parse_decimal(begin, end, number, true);
+}
+
+static inline bool parse_float(const char** begin, const char* end, float* number)
+{
+    return parse_decimal(begin, end, number, false);
+}
+
+static bool parse_number(const string_t* value, float* number, bool percent)
+{
+    const char* it = value->data;
+    const char* end = it + value->length;
+    if(!parse_float(&it, end, number))
+        return false;
+
+    if(percent) {
+        if(skip_delim(&it, end, '%'))
+            *number /= 100.f;
+        *number = otfsvg_clamp(*number, 0.f, 1.f);
+    }
+
+    return true;
+}
+
+typedef enum {
+    length_type_unknown,
+    length_type_percent,
+    length_type_number,
+    length_type_px,
     length_type_pt,
     length_type_pc,
     length_type_in,
@@ -1137,12 +2004,8 @@ static bool parse_length_value(const char** begin, const char* end, length_t* le
     return true;
 }
 
-static bool parse_length(element_t* element, int id, length_t* length, bool negative, bool inherit)
+static bool parse_length(const string_t* value, length_t* length, bool negative)
 {
-    const string_t* value = find_property(element, id, inherit);
-    if(value == NULL)
-        return false;
-
     const char* it = value->data;
     const char* end = it + value->length;
     if(parse_length_value(&it, end, length, negative))
@@ -1193,170 +2056,192 @@ typedef enum {
 typedef struct {
     paint_type_t type;
     color_t color;
-    string_t id;
+    uint32_t idoffset;
+    uint32_t idlength;
 } paint_t;
 
 typedef struct {
     const char* name;
+    size_t length;
     uint32_t value;
 } color_entry_t;
 
-static int color_entry_compare(const void* a, const void* b)
-{
-    const char* name = a;
-    const color_entry_t* entry = b;
-    return strcmp(name, entry->name);
-}
-
-static color_entry_t colormap[] = {
-    {"aliceblue", 0xF0F8FF},
-    {"antiquewhite", 0xFAEBD7},
-    {"aqua", 0x00FFFF},
-    {"aquamarine", 0x7FFFD4},
-    {"azure", 0xF0FFFF},
-    {"beige", 0xF5F5DC},
-    {"bisque", 0xFFE4C4},
-    {"black", 0x000000},
-    {"blanchedalmond", 0xFFEBCD},
-    {"blue", 0x0000FF},
-    {"blueviolet", 0x8A2BE2},
-    {"brown", 0xA52A2A},
-    {"burlywood", 0xDEB887},
-    {"cadetblue", 0x5F9EA0},
-    {"chartreuse", 0x7FFF00},
-    {"chocolate", 0xD2691E},
-    {"coral", 0xFF7F50},
-    {"cornflowerblue", 0x6495ED},
-    {"cornsilk", 0xFFF8DC},
-    {"crimson", 0xDC143C},
-    {"cyan", 0x00FFFF},
-    {"darkblue", 0x00008B},
-    {"darkcyan", 0x008B8B},
-    {"darkgoldenrod", 0xB8860B},
-    {"darkgray", 0xA9A9A9},
-    {"darkgreen", 0x006400},
-    {"darkgrey", 0xA9A9A9},
-    {"darkkhaki", 0xBDB76B},
-    {"darkmagenta", 0x8B008B},
-    {"darkolivegreen", 0x556B2F},
-    {"darkorange", 0xFF8C00},
-    {"darkorchid", 0x9932CC},
-    {"darkred", 0x8B0000},
-    {"darksalmon", 0xE9967A},
-    {"darkseagreen", 0x8FBC8F},
-    {"darkslateblue", 0x483D8B},
-    {"darkslategray", 0x2F4F4F},
-    {"darkslategrey", 0x2F4F4F},
-    {"darkturquoise", 0x00CED1},
-    {"darkviolet", 0x9400D3},
-    {"deeppink", 0xFF1493},
-    {"deepskyblue", 0x00BFFF},
-    {"dimgray", 0x696969},
-    {"dimgrey", 0x696969},
-    {"dodgerblue", 0x1E90FF},
-    {"firebrick", 0xB22222},
-    {"floralwhite", 0xFFFAF0},
-    {"forestgreen", 0x228B22},
-    {"fuchsia", 0xFF00FF},
-    {"gainsboro", 0xDCDCDC},
-    {"ghostwhite", 0xF8F8FF},
-    {"gold", 0xFFD700},
-    {"goldenrod", 0xDAA520},
-    {"gray", 0x808080},
-    {"green", 0x008000},
-    {"greenyellow", 0xADFF2F},
-    {"grey", 0x808080},
-    {"honeydew", 0xF0FFF0},
-    {"hotpink", 0xFF69B4},
-    {"indianred", 0xCD5C5C},
-    {"indigo", 0x4B0082},
-    {"ivory", 0xFFFFF0},
-    {"khaki", 0xF0E68C},
-    {"lavender", 0xE6E6FA},
-    {"lavenderblush", 0xFFF0F5},
-    {"lawngreen", 0x7CFC00},
-    {"lemonchiffon", 0xFFFACD},
-    {"lightblue", 0xADD8E6},
-    {"lightcoral", 0xF08080},
-    {"lightcyan", 0xE0FFFF},
-    {"lightgoldenrodyellow", 0xFAFAD2},
-    {"lightgray", 0xD3D3D3},
-    {"lightgreen", 0x90EE90},
-    {"lightgrey", 0xD3D3D3},
-    {"lightpink", 0xFFB6C1},
-    {"lightsalmon", 0xFFA07A},
-    {"lightseagreen", 0x20B2AA},
-    {"lightskyblue", 0x87CEFA},
-    {"lightslategray", 0x778899},
-    {"lightslategrey", 0x778899},
-    {"lightsteelblue", 0xB0C4DE},
-    {"lightyellow", 0xFFFFE0},
-    {"lime", 0x00FF00},
-    {"limegreen", 0x32CD32},
-    {"linen", 0xFAF0E6},
-    {"magenta", 0xFF00FF},
-    {"maroon", 0x800000},
-    {"mediumaquamarine", 0x66CDAA},
-    {"mediumblue", 0x0000CD},
-    {"mediumorchid", 0xBA55D3},
-    {"mediumpurple", 0x9370DB},
-    {"mediumseagreen", 0x3CB371},
-    {"mediumslateblue", 0x7B68EE},
-    {"mediumspringgreen", 0x00FA9A},
-    {"mediumturquoise", 0x48D1CC},
-    {"mediumvioletred", 0xC71585},
-    {"midnightblue", 0x191970},
-    {"mintcream", 0xF5FFFA},
-    {"mistyrose", 0xFFE4E1},
-    {"moccasin", 0xFFE4B5},
-    {"navajowhite", 0xFFDEAD},
-    {"navy", 0x000080},
-    {"oldlace", 0xFDF5E6},
-    {"olive", 0x808000},
-    {"olivedrab", 0x6B8E23},
-    {"orange", 0xFFA500},
-    {"orangered", 0xFF4500},
-    {"orchid", 0xDA70D6},
-    {"palegoldenrod", 0xEEE8AA},
-    {"palegreen", 0x98FB98},
-    {"paleturquoise", 0xAFEEEE},
-    {"palevioletred", 0xDB7093},
-    {"papayawhip", 0xFFEFD5},
-    {"peachpuff", 0xFFDAB9},
-    {"peru", 0xCD853F},
-    {"pink", 0xFFC0CB},
-    {"plum", 0xDDA0DD},
-    {"powderblue", 0xB0E0E6},
-    {"purple", 0x800080},
-    {"rebeccapurple", 0x663399},
-    {"red", 0xFF0000},
-    {"rosybrown", 0xBC8F8F},
-    {"royalblue", 0x4169E1},
-    {"saddlebrown", 0x8B4513},
-    {"salmon", 0xFA8072},
-    {"sandybrown", 0xF4A460},
-    {"seagreen", 0x2E8B57},
-    {"seashell", 0xFFF5EE},
-    {"sienna", 0xA0522D},
-    {"silver", 0xC0C0C0},
-    {"skyblue", 0x87CEEB},
-    {"slateblue", 0x6A5ACD},
-    {"slategray", 0x708090},
-    {"slategrey", 0x708090},
-    {"snow", 0xFFFAFA},
-    {"springgreen", 0x00FF7F},
-    {"steelblue", 0x4682B4},
-    {"tan", 0xD2B48C},
-    {"teal", 0x008080},
-    {"thistle", 0xD8BFD8},
-    {"tomato", 0xFF6347},
-    {"turquoise", 0x40E0D0},
-    {"violet", 0xEE82EE},
-    {"wheat", 0xF5DEB3},
-    {"white", 0xFFFFFF},
-    {"whitesmoke", 0xF5F5F5},
-    {"yellow", 0xFFFF00},
-    {"yellowgreen", 0x9ACD32}
+static const color_entry_t colormap[] = {
+    {"aliceblue", 9, 0xF0F8FF},
+    {"antiquewhite", 12, 0xFAEBD7},
+    {"aqua", 4, 0x00FFFF},
+    {"aquamarine", 10, 0x7FFFD4},
+    {"azure", 5, 0xF0FFFF},
+    {"beige", 5, 0xF5F5DC},
+    {"bisque", 6, 0xFFE4C4},
+    {"black", 5, 0x000000},
+    {"blanchedalmond", 14, 0xFFEBCD},
+    {"blue", 4, 0x0000FF},
+    {"blueviolet", 10, 0x8A2BE2},
+    {"brown", 5, 0xA52A2A},
+    {"burlywood", 9, 0xDEB887},
+    {"cadetblue", 9, 0x5F9EA0},
+    {"chartreuse", 10, 0x7FFF00},
+    {"chocolate", 9, 0xD2691E},
+    {"coral", 5, 0xFF7F50},
+    {"cornflowerblue", 14, 0x6495ED},
+    {"cornsilk", 8, 0xFFF8DC},
+    {"crimson", 7, 0xDC143C},
+    {"cyan", 4, 0x00FFFF},
+    {"darkblue", 8, 0x00008B},
+    {"darkcyan", 8, 0x008B8B},
+    {"darkgoldenrod", 13, 0xB8860B},
+    {"darkgray", 8, 0xA9A9A9},
+    {"darkgreen", 9, 0x006400},
+    {"darkgrey", 8, 0xA9A9A9},
+    {"darkkhaki", 9, 0xBDB76B},
+    {"darkmagenta", 11, 0x8B008B},
+    {"darkolivegreen", 14, 0x556B2F},
+    {"darkorange", 10, 0xFF8C00},
+    {"darkorchid", 10, 0x9932CC},
+    {"darkred", 7, 0x8B0000},
+    {"darksalmon", 10, 0xE9967A},
+    {"darkseagreen", 12, 0x8FBC8F},
+    {"darkslateblue", 13, 0x483D8B},
+    {"darkslategray", 13, 0x2F4F4F},
+    {"darkslategrey", 13, 0x2F4F4F},
+    {"darkturquoise", 13, 0x00CED1},
+    {"darkviolet", 10, 0x9400D3},
+    {"deeppink", 8, 0xFF1493},
+    {"deepskyblue", 11, 0x00BFFF},
+    {"dimgray", 7, 0x696969},
+    {"dimgrey", 7, 0x696969},
+    {"dodgerblue", 10, 0x1E90FF},
+    {"firebrick", 9, 0xB22222},
+    {"floralwhite", 11, 0xFFFAF0},
+    {"forestgreen", 11, 0x228B22},
+    {"fuchsia", 7, 0xFF00FF},
+    {"gainsboro", 9, 0xDCDCDC},
+    {"ghostwhite", 10, 0xF8F8FF},
+    {"gold", 4, 0xFFD700},
+    {"goldenrod", 9, 0xDAA520},
+    {"gray", 4, 0x808080},
+    {"green", 5, 0x008000},
+    {"greenyellow", 11, 0xADFF2F},
+    {"grey", 4, 0x808080},
+    {"honeydew", 8, 0xF0FFF0},
+    {"hotpink", 7, 0xFF69B4},
+    {"indianred", 9, 0xCD5C5C},
+    {"indigo", 6, 0x4B0082},
+    {"ivory", 5, 0xFFFFF0},
+    {"khaki", 5, 0xF0E68C},
+    {"lavender", 8, 0xE6E6FA},
+    {"lavenderblush", 13, 0xFFF0F5},
+    {"lawngreen", 9, 0x7CFC00},
+    {"lemonchiffon", 12, 0xFFFACD},
+    {"lightblue", 9, 0xADD8E6},
+    {"lightcoral", 10, 0xF08080},
+    {"lightcyan", 9, 0xE0FFFF},
+    {"lightgoldenrodyellow", 20, 0xFAFAD2},
+    {"lightgray", 9, 0xD3D3D3},
+    {"lightgreen", 10, 0x90EE90},
+    {"lightgrey", 9, 0xD3D3D3},
+    {"lightpink", 9, 0xFFB6C1},
+    {"lightsalmon", 11, 0xFFA07A},
+    {"lightseagreen", 13, 0x20B2AA},
+    {"lightskyblue", 12, 0x87CEFA},
+    {"lightslategray", 14, 0x778899},
+    {"lightslategrey", 14, 0x778899},
+    {"lightsteelblue", 14, 0xB0C4DE},
+    {"lightyellow", 11, 0xFFFFE0},
+    {"lime", 4, 0x00FF00},
+    {"limegreen", 9, 0x32CD32},
+    {"linen", 5, 0xFAF0E6},
+    {"magenta", 7, 0xFF00FF},
+    {"maroon", 6, 0x800000},
+    {"mediumaquamarine", 16, 0x66CDAA},
+    {"mediumblue", 10, 0x0000CD},
+    {"mediumorchid", 12, 0xBA55D3},
+    {"mediumpurple", 12, 0x9370DB},
+    {"mediumseagreen", 14, 0x3CB371},
+    {"mediumslateblue", 15, 0x7B68EE},
+    {"mediumspringgreen", 17, 0x00FA9A},
+    {"mediumturquoise", 15, 0x48D1CC},
+    {"mediumvioletred", 15, 0xC71585},
+    {"midnightblue", 12, 0x191970},
+    {"mintcream", 9, 0xF5FFFA},
+    {"mistyrose", 9, 0xFFE4E1},
+    {"moccasin", 8, 0xFFE4B5},
+    {"navajowhite", 11, 0xFFDEAD},
+    {"navy", 4, 0x000080},
+    {"oldlace", 7, 0xFDF5E6},
+    {"olive", 5, 0x808000},
+    {"olivedrab", 9, 0x6B8E23},
+    {"orange", 6, 0xFFA500},
+    {"orangered", 9, 0xFF4500},
+    {"orchid", 6, 0xDA70D6},
+    {"palegoldenrod", 13, 0xEEE8AA},
+    {"palegreen", 9, 0x98FB98},
+    {"paleturquoise", 13, 0xAFEEEE},
+    {"palevioletred", 13, 0xDB7093},
+    {"papayawhip", 10, 0xFFEFD5},
+    {"peachpuff", 9, 0xFFDAB9},
+    {"peru", 4, 0xCD853F},
+    {"pink", 4, 0xFFC0CB},
+    {"plum", 4, 0xDDA0DD},
+    {"powderblue", 10, 0xB0E0E6},
+    {"purple", 6, 0x800080},
+    {"rebeccapurple", 13, 0x663399},
+    {"red", 3, 0xFF0000},
+    {"rosybrown", 9, 0xBC8F8F},
+    {"royalblue", 9, 0x4169E1},
+    {"saddlebrown", 11, 0x8B4513},
+    {"salmon", 6, 0xFA8072},
+    {"sandybrown", 10, 0xF4A460},
+    {"seagreen", 8, 0x2E8B57},
+    {"seashell", 8, 0xFFF5EE},
+    {"sienna", 6, 0xA0522D},
+    {"silver", 6, 0xC0C0C0},
+    {"skyblue", 7, 0x87CEEB},
+    {"slateblue", 9, 0x6A5ACD},
+    {"slategray", 9, 0x708090},
+    {"slategrey", 9, 0x708090},
+    {"snow", 4, 0xFFFAFA},
+    {"springgreen", 11, 0x00FF7F},
+    {"steelblue", 9, 0x4682B4},
+    {"tan", 3, 0xD2B48C},
+    {"teal", 4, 0x008080},
+    {"thistle", 7, 0xD8BFD8},
+    {"tomato", 6, 0xFF6347},
+    {"turquoise", 9, 0x40E0D0},
+    {"violet", 6, 0xEE82EE},
+    {"wheat", 5, 0xF5DEB3},
+    {"white", 5, 0xFFFFFF},
+    {"whitesmoke", 10, 0xF5F5F5},
+    {"yellow", 6, 0xFFFF00},
+    {"yellowgreen", 11, 0x9ACD32}
+};
+
+/* Generated by tools/namehash.py from colormap. */
+static const uint8_t colorhash[148] = {
+    0, 5, 0, 0, 2, 0, 1, 6, 0, 1, 0, 8, 0, 0, 0, 0,
+    0, 0, 3, 1, 0, 0, 0, 3, 3, 1, 0, 1, 0, 2, 0, 1,
+    1, 1, 0, 0, 0, 0, 5, 0, 4, 2, 2, 0, 0, 0, 1, 0,
+    2, 0, 3, 0, 1, 0, 0, 6, 6, 5, 2, 1, 2, 0, 0, 0,
+    15, 9, 0, 0, 0, 0, 0, 0, 0, 5, 2, 8, 0, 0, 0, 1,
+    1, 0, 0, 0, 0, 2, 8, 5, 0, 0, 0, 0, 5, 1, 1, 3,
+    0, 22, 9, 0, 0, 4, 2, 5, 1, 21, 8, 18, 6, 10, 4, 0,
+    0, 0, 0, 0, 0, 3, 18, 1, 0, 14, 11, 2, 0, 23, 34, 0,
+    0, 9, 0, 0, 6, 0, 1, 6, 80, 0, 1, 10, 1, 0, 0, 0,
+    0, 117, 0, 3
+};
+
+static const uint8_t colorslots[148] = {
+    66, 83, 69, 146, 21, 34, 40, 57, 85, 12, 141, 58, 89, 0, 33, 2,
+    143, 76, 71, 72, 63, 67, 68, 70, 6, 4, 131, 7, 11, 138, 29, 139,
+    25, 61, 114, 10, 145, 50, 16, 17, 82, 122, 24, 117, 37, 27, 62, 49,
+    31, 23, 132, 41, 47, 8, 90, 43, 94, 127, 104, 103, 96, 81, 124, 64,
+    42, 95, 79, 109, 116, 13, 15, 119, 35, 142, 20, 28, 99, 65, 73, 56,
+    91, 86, 18, 123, 39, 121, 118, 1, 88, 36, 80, 84, 126, 120, 100, 44,
+    46, 106, 26, 101, 136, 87, 53, 130, 144, 38, 105, 112, 52, 55, 137, 22,
+    97, 75, 115, 111, 9, 133, 108, 107, 129, 102, 19, 92, 60, 140, 135, 59,
+    147, 98, 74, 110, 113, 14, 93, 134, 5, 78, 48, 128, 51, 45, 125, 32,
+    3, 30, 77, 54
 };
 
 static bool parse_color_component(const char** begin, const char* end, int* component)
@@ -1421,18 +2306,19 @@ static bool parse_color_value(const char** begin, const char* end, color_t* colo
         color->type = color_type_fixed;
         color->value = (0xFF000000 | red << 16 | green << 8 | blue);
     } else {
-        int length = 0;
+        size_t length = 0;
         char name[24];
-        while(it < end && length < 24 && isalpha(*it))
+        while(it < end && isalpha(*it)) {
+            if(length == sizeof(name))
+                return false;
             name[length++] = tolower(*it++);
+        }
+
         if(length == 0)
             return false;
-        name[length] = 0;
-
-        size_t count = sizeof(colormap);
-        size_t size = sizeof(color_entry_t);
-        color_entry_t* entry = bsearch(name, colormap, count / size, size, color_entry_compare);
-        if(entry == NULL)
+        size_t count = sizeof(colormap) / sizeof(color_entry_t);
+        const color_entry_t* entry = &colormap[name_slot(name, length, colorhash, colorslots, count)];
+        if(entry->length != length || memcmp(entry->name, name, length) != 0)
             return false;
         color->type = color_type_fixed;
         color->value = entry->value | 0xFF000000;
@@ -1443,11 +2329,8 @@ static bool parse_color_value(const char** begin, const char* end, color_t* colo
     return true;
 }
 
-static bool parse_color(element_t* element, int id, color_t* color)
+static bool parse_color(const string_t* value, color_t* color)
 {
-    const string_t* value = find_property(element, id, true);
-    if(value == NULL)
-        return false;
     const char* it = value->data;
     const char* end = it + value->length;
     if(parse_color_value(&it, end, color))
@@ -1455,14 +2338,12 @@ static bool parse_color(element_t* element, int id, color_t* color)
     return false;
 }
 
-static bool parse_paint(element_t* element, int id, paint_t* paint)
+static bool parse_paint(const char* source, const string_t* value, paint_t* paint)
 {
-    const string_t* value = find_property(element, id, true);
-    if(value == NULL)
-        return false;
-
     const char* it = value->data;
     const char* end = it + value->length;
+    paint->idoffset = 0;
+    paint->idlength = 0;
     if(skip_string(&it, end, "none")) {
         paint->type = paint_type_none;
         return !skip_ws(&it, end);
@@ -1476,8 +2357,8 @@ static bool parse_paint(element_t* element, int id, paint_t* paint)
             ++it;
 
         paint->type = paint_type_url;
-        paint->id.data = begin;
-        paint->id.length = it - begin;
+        paint->idoffset = (uint32_t)(begin - source);
+        paint->idlength = (uint32_t)(it - begin);
         paint->color.value = otfsvg_transparent_color;
         if(!skip_delim(&it, end, ')') || (skip_ws(&it, end) && !parse_color_value(&it, end, &paint->color)))
             return false;
@@ -1491,8 +2372,8 @@ static bool parse_paint(element_t* element, int id, paint_t* paint)
         while(it < end && IS_NAMECHAR(*it))
             ++it;
         paint->type = paint_type_var;
-        paint->id.data = begin;
-        paint->id.length = it - begin;
+        paint->idoffset = (uint32_t)(begin - source);
+        paint->idlength = (uint32_t)(it - begin);
         paint->color.value = otfsvg_transparent_color;
         if(skip_ws(&it, end) && skip_delim(&it, end, ',') && !(skip_ws(&it, end) && parse_color_value(&it, end, &paint->color)))
             return false;
@@ -1507,12 +2388,8 @@ static bool parse_paint(element_t* element, int id, paint_t* paint)
     return false;
 }
 
-static bool parse_view_box(element_t* element, int id, otfsvg_rect_t* viewbox)
+static bool parse_view_box(const string_t* value, otfsvg_rect_t* viewbox)
 {
-    const string_t* value = find_property(element, id, false);
-    if(value == NULL)
-        return false;
-
     const char* it = value->data;
     const char* end = it + value->length;
     float x = 0;
@@ -1604,13 +2481,9 @@ static bool parse_transform_value(const char** begin, const char* end, transform
     return true;
 }
 
-static bool parse_transform(element_t* element, int id, otfsvg_matrix_t* matrix)
+static bool parse_transform(const string_t* value, otfsvg_matrix_t* matrix)
 {
     otfsvg_matrix_init_identity(matrix);
-    const string_t* value = find_property(element, id, false);
-    if(value == NULL)
-        return false;
-
     const char* it = value->data;
     const char* end = it + value->length;
 
@@ -1681,13 +2554,8 @@ static bool parse_arc_flag(const char** begin, const char* end, bool* flag)
     return true;
 }
 
-static bool parse_path(element_t* element, int id, otfsvg_path_t* path)
+static bool parse_path(const string_t* value, otfsvg_path_t* path)
 {
-    otfsvg_path_clear(path);
-    const string_t* value = find_property(element, id, false);
-    if(value == NULL)
-        return false;
-
     const char* it = value->data;
     const char* end = it + value->length;
     if(it >= end || !(*it == 'M' || *it == 'm'))
@@ -1850,20 +2718,18 @@ static bool parse_path(element_t* element, int id, otfsvg_path_t* path)
             break;
 
         last_command = command;
-        if(IS_ALPHA(*it))
+        if(IS_ALPHA(*it)) {
             command = *it++;
+        } else if(command == 'Z' || command == 'z') {
+            return false;
+        }
     }
 
     return true;
 }
 
-static bool parse_points(element_t* element, int id, otfsvg_path_t* path)
+static bool parse_points(const string_t* value, otfsvg_path_t* path)
 {
-    otfsvg_path_clear(path);
-    const string_t* value = find_property(element, id, false);
-    if(value == NULL)
-        return false;
-
     const char* it = value->data;
     const char* end = it + value->length;
 
@@ -1906,12 +2772,8 @@ typedef struct {
     position_scale_t scale;
 } position_t;
 
-static bool parse_position(element_t* element, int id, position_t* position)
+static bool parse_position(const string_t* value, position_t* position)
 {
-    const string_t* value = find_property(element, id, false);
-    if(value == NULL)
-        return false;
-
     const char* it = value->data;
     const char* end = it + value->length;
     if(skip_string(&it, end, "none"))
@@ -2053,12 +2915,8 @@ static void position_get_matrix(const position_t* position, otfsvg_matrix_t* mat
     otfsvg_matrix_translate(matrix, tx, ty);
 }
 
-static bool parse_line_cap(element_t* element, int id, otfsvg_line_cap_t* linecap)
+static bool parse_line_cap(const string_t* value, otfsvg_line_cap_t* linecap)
 {
-    const string_t* value = find_property(element, id, true);
-    if(value == NULL)
-        return false;
-
     const char* it = value->data;
     const char* end = it + value->length;
     if(skip_string(&it, end, "round"))
@@ -2067,15 +2925,13 @@ static bool parse_line_cap(element_t* element, int id, otfsvg_line_cap_t* lineca
         *linecap = otfsvg_line_cap_square;
     else if(skip_string(&it, end, "butt"))
         *linecap = otfsvg_line_cap_butt;
+    else
+        return false;
     return !skip_ws(&it, end);
 }
 
-static bool parse_line_join(element_t* element, int id, otfsvg_line_join_t* linejoin)
+static bool parse_line_join(const string_t* value, otfsvg_line_join_t* linejoin)
 {
-    const string_t* value = find_property(element, id, true);
-    if(value == NULL)
-        return false;
-
     const char* it = value->data;
     const char* end = it + value->length;
     if(skip_string(&it, end, "bevel"))
@@ -2084,30 +2940,26 @@ static bool parse_line_join(element_t* element, int id, otfsvg_line_join_t* line
         *linejoin = otfsvg_line_join_round;
     else if(skip_string(&it, end, "miter"))
         *linejoin = otfsvg_line_join_miter;
+    else
+        return false;
     return !skip_ws(&it, end);
 }
 
-static bool parse_winding(element_t* element, int id, otfsvg_fill_rule_t* winding)
+static bool parse_winding(const string_t* value, otfsvg_fill_rule_t* winding)
 {
-    const string_t* value = find_property(element, id, true);
-    if(value == NULL)
-        return false;
-
     const char* it = value->data;
     const char* end = it + value->length;
     if(skip_string(&it, end, "evenodd"))
         *winding = otfsvg_fill_rule_even_odd;
     else if(skip_string(&it, end, "nonzero"))
         *winding = otfsvg_fill_rule_non_zero;
+    else
+        return false;
     return !skip_ws(&it, end);
 }
 
-static bool parse_gradient_spread(element_t* element, int id, otfsvg_gradient_spread_t* spread)
+static bool parse_gradient_spread(const string_t* value, otfsvg_gradient_spread_t* spread)
 {
-    const string_t* value = find_property(element, id, false);
-    if(value == NULL)
-        return false;
-
     const char* it = value->data;
     const char* end = it + value->length;
     if(skip_string(&it, end, "reflect"))
@@ -2116,6 +2968,8 @@ static bool parse_gradient_spread(element_t* element, int id, otfsvg_gradient_sp
         *spread = otfsvg_gradient_spread_repeat;
     else if(skip_string(&it, end, "pad"))
         *spread = otfsvg_gradient_spread_pad;
+    else
+        return false;
     return !skip_ws(&it, end);
 }
 
@@ -2124,18 +2978,16 @@ typedef enum {
     display_none
 } display_t;
 
-static bool parse_display(element_t* element, int id, display_t* display)
+static bool parse_display(const string_t* value, display_t* display)
 {
-    const string_t* value = find_property(element, id, false);
-    if(value == NULL)
-        return false;
-
     const char* it = value->data;
     const char* end = it + value->length;
     if(skip_string(&it, end, "none"))
         *display = display_none;
     else if(skip_string(&it, end, "inline"))
         *display = display_inline;
+    else
+        return false;
     return !skip_ws(&it, end);
 }
 
@@ -2144,18 +2996,16 @@ typedef enum {
     visibility_hidden
 } visibility_t;
 
-static bool parse_visibility(element_t* element, int id, visibility_t* visibility)
+static bool parse_visibility(const string_t* value, visibility_t* visibility)
 {
-    const string_t* value = find_property(element, id, true);
-    if(value == NULL)
-        return false;
-
     const char* it = value->data;
     const char* end = it + value->length;
     if(skip_string(&it, end, "hidden"))
         *visibility = visibility_hidden;
     else if(skip_string(&it, end, "visible"))
         *visibility = visibility_visible;
+    else
+        return false;
     return !skip_ws(&it, end);
 }
 
@@ -2164,124 +3014,807 @@ typedef enum {
     units_type_user_space_on_use
 } units_type_t;
 
-static bool parse_units(element_t* element, int id, units_type_t* units)
+static bool parse_units(const string_t* value, units_type_t* units)
 {
-    const string_t* value = find_property(element, id, false);
-    if(value == NULL)
-        return false;
-
     const char* it = value->data;
     const char* end = it + value->length;
     if(skip_string(&it, end, "userSpaceOnUse"))
         *units = units_type_user_space_on_use;
     else if(skip_string(&it, end, "objectBoundingBox"))
         *units = units_type_object_bounding_box;
+    else
+        return false;
     return !skip_ws(&it, end);
 }
 
-typedef enum {
-    render_mode_display,
-    render_mode_clipping,
-    render_mode_bounding
-} render_mode_t;
-
-typedef struct {
-    element_t* element;
-    render_mode_t mode;
-    float opacity;
+/*
+ * Presentation attributes are parsed once, when the element is loaded, into a typed value stored next to the string in
+ * the element's block; the renderer only reads these. An attribute whose value does not parse keeps a NULL typed value,
+ * so it still hides the inherited one and the renderer falls back to the default.
+ */
+union typed_value {
+    float number;
+    length_t length;
+    color_t color;
+    paint_t paint;
     otfsvg_matrix_t matrix;
-    otfsvg_rect_t bbox;
-    element_t* clippath;
-    bool compositing;
-} render_state_t;
+    otfsvg_rect_t viewbox;
+    position_t position;
+    otfsvg_line_cap_t linecap;
+    otfsvg_line_join_t linejoin;
+    otfsvg_fill_rule_t winding;
+    otfsvg_gradient_spread_t spread;
+    display_t display;
+    visibility_t visibility;
+    units_type_t units;
+};
+
+static bool parse_typed_value(const char* source, int id, const string_t* value, typed_value_t* typed)
+{
+    bool success;
+    switch(id) {
+    case ID_FILL_OPACITY:
+    case ID_OFFSET:
+    case ID_OPACITY:
+    case ID_SOLID_OPACITY:
+    case ID_STOP_OPACITY:
+    case ID_STROKE_OPACITY:
+        success = parse_number(value, &typed->number, true);
+        break;
+    case ID_STROKE_MITERLIMIT:
+        success = parse_number(value, &typed->number, false);
+        break;
+    case ID_CX:
+    case ID_CY:
+    case ID_FX:
+    case ID_FY:
+    case ID_STROKE_DASHOFFSET:
+    case ID_X:
+    case ID_X1:
+    case ID_X2:
+    case ID_Y:
+    case ID_Y1:
+    case ID_Y2:
+        success = parse_length(value, &typed->length, true);
+        break;
+    case ID_HEIGHT:
+    case ID_R:
+    case ID_RX:
+    case ID_RY:
+    case ID_STROKE_WIDTH:
+    case ID_WIDTH:
+        success = parse_length(value, &typed->length, false);
+        break;
+    case ID_SOLID_COLOR:
+    case ID_STOP_COLOR:
+        success = parse_color(value, &typed->color);
+        break;
+    case ID_FILL:
+    case ID_STROKE:
+        success = parse_paint(source, value, &typed->paint);
+        break;
+    case ID_GRADIENT_TRANSFORM:
+    case ID_TRANSFORM:
+        success = parse_transform(value, &typed->matrix);
+        break;
+    case ID_VIEWBOX:
+        success = parse_view_box(value, &typed->viewbox);
+        break;
+    case ID_PRESERVE_ASPECT_RATIO:
+        success = parse_position(value, &typed->position);
+        break;
+    case ID_STROKE_LINECAP:
+        success = parse_line_cap(value, &typed->linecap);
+        break;
+    case ID_STROKE_LINEJOIN:
+        success = parse_line_join(value, &typed->linejoin);
+        break;
+    case ID_CLIP_RULE:
+    case ID_FILL_RULE:
+        success = parse_winding(value, &typed->winding);
+        break;
+    case ID_SPREAD_METHOD:
+        success = parse_gradient_spread(value, &typed->spread);
+        break;
+    case ID_DISPLAY:
+        success = parse_display(value, &typed->display);
+        break;
+    case ID_VISIBILITY:
+        success = parse_visibility(value, &typed->visibility);
+        break;
+    case ID_CLIP_PATH_UNITS:
+    case ID_GRADIENT_UNITS:
+        success = parse_units(value, &typed->units);
+        break;
+    default:
+        success = false;
+        break;
+    }
+
+    return success;
+}
 
-static bool document_fill_path(const otfsvg_document_t* document, const render_state_t* state, otfsvg_fill_rule_t winding)
+static inline const typed_value_t* property_value(const property_t* property)
 {
-    otfsvg_canvas_t* canvas = document->canvas;
+    if(property->typed == 0)
+        return NULL;
+    return (const typed_value_t*)((const char*)(property) + property->typed);
+}
+
+static inline const typed_value_t* find_value(const element_t* element, int id)
+{
+    const property_t* property = find_property_entry(element, id);
+    if(property == NULL)
+        return NULL;
+    return property_value(property);
+}
+
+static bool get_number(const element_t* element, int id, float* number)
+{
+    const typed_value_t* value = find_value(element, id);
+    if(value == NULL)
+        return false;
+    *number = value->number;
+    return true;
+}
+
+static bool get_length(const element_t* element, int id, length_t* length)
+{
+    const typed_value_t* value = find_value(element, id);
+    if(value == NULL)
+        return false;
+    *length = value->length;
+    return true;
+}
+
+static bool get_transform(const element_t* element, int id, otfsvg_matrix_t* matrix)
+{
+    const typed_value_t* value = find_value(element, id);
+    if(value == NULL) {
+        otfsvg_matrix_init_identity(matrix);
+        return false;
+    }
+
+    *matrix = value->matrix;
+    return true;
+}
+
+static bool get_view_box(const element_t* element, int id, otfsvg_rect_t* viewbox)
+{
+    const typed_value_t* value = find_value(element, id);
+    if(value == NULL)
+        return false;
+    *viewbox = value->viewbox;
+    return true;
+}
+
+static bool get_position(const element_t* element, int id, position_t* position)
+{
+    const typed_value_t* value = find_value(element, id);
+    if(value == NULL)
+        return false;
+    *position = value->position;
+    return true;
+}
+
+static bool get_gradient_spread(const element_t* element, int id, otfsvg_gradient_spread_t* spread)
+{
+    const typed_value_t* value = find_value(element, id);
+    if(value == NULL)
+        return false;
+    *spread = value->spread;
+    return true;
+}
+
+static bool get_display(const element_t* element, int id, display_t* display)
+{
+    const typed_value_t* value = find_value(element, id);
+    if(value == NULL)
+        return false;
+    *display = value->display;
+    return true;
+}
+
+static bool get_units(const element_t* element, int id, units_type_t* units)
+{
+    const typed_value_t* value = find_value(element, id);
+    if(value == NULL)
+        return false;
+    *units = value->units;
+    return true;
+}
+
+/*
+ * Computed values of the inherited properties. Each element points at the record that applies to it: its parent's
+ * when it declares none of these properties itself, otherwise its own copy with its declarations applied. The records
+ * are built along the document tree when the element is loaded; content instantiated by <use> inherits from the <use>
+ * element instead, so render_state_begin cascades those records again while rendering.
+ */
+struct style {
+    paint_t fill;
+    paint_t stroke;
+    color_t stop_color;
+    color_t solid_color;
+    length_t stroke_width;
+    length_t stroke_dashoffset;
+    float fill_opacity;
+    float stroke_opacity;
+    float stop_opacity;
+    float solid_opacity;
+    float stroke_miterlimit;
+    otfsvg_line_cap_t stroke_linecap;
+    otfsvg_line_join_t stroke_linejoin;
+    otfsvg_fill_rule_t fill_rule;
+    otfsvg_fill_rule_t clip_rule;
+    visibility_t visibility;
+};
+
+static const style_t default_style = {
+    {paint_type_color, {color_type_fixed, otfsvg_black_color}},
+    {paint_type_none, {color_type_fixed, otfsvg_transparent_color}},
+    {color_type_fixed, otfsvg_black_color},
+    {color_type_fixed, otfsvg_black_color},
+    {1, length_type_number},
+    {0, length_type_number},
+    1.f,
+    1.f,
+    1.f,
+    1.f,
+    4.f,
+    otfsvg_line_cap_butt,
+    otfsvg_line_join_miter,
+    otfsvg_fill_rule_non_zero,
+    otfsvg_fill_rule_non_zero,
+    visibility_visible
+};
+
+static bool style_cascade(style_t* style, const style_t* parent, const element_t* element)
+{
+    *style = *parent;
+    bool declared = false;
+    const property_t* property = element_properties(element);
+    for(int i = 0; i < element->count; i++, property++) {
+        const typed_value_t* value = property_value(property);
+        switch(property->id) {
+        case ID_FILL:
+            style->fill = value ? value->paint : default_style.fill;
+            break;
+        case ID_STROKE:
+            style->stroke = value ? value->paint : default_style.stroke;
+            break;
+        case ID_STOP_COLOR:
+            style->stop_color = value ? value->color : default_style.stop_color;
+            break;
+        case ID_SOLID_COLOR:
+            style->solid_color = value ? value->color : default_style.solid_color;
+            break;
+        case ID_STROKE_WIDTH:
+            style->stroke_width = value ? value->length : default_style.stroke_width;
+            break;
+        case ID_STROKE_DASHOFFSET:
+            style->stroke_dashoffset = value ? value->length : default_style.stroke_dashoffset;
+            break;
+        case ID_FILL_OPACITY:
+            style->fill_opacity = value ? value->number : default_style.fill_opacity;
+            break;
+        case ID_STROKE_OPACITY:
+            style->stroke_opacity = value ? value->number : default_style.stroke_opacity;
+            break;
+        case ID_STOP_OPACITY:
+            style->stop_opacity = value ? value->number : default_style.stop_opacity;
+            break;
+        case ID_SOLID_OPACITY:
+            style->solid_opacity = value ? value->number : default_style.solid_opacity;
+            break;
+        case ID_STROKE_MITERLIMIT:
+            style->stroke_miterlimit = value ? value->number : default_style.stroke_miterlimit;
+            break;
+        case ID_STROKE_LINECAP:
+            style->stroke_linecap = value ? value->linecap : default_style.stroke_linecap;
+            break;
+        case ID_STROKE_LINEJOIN:
+            style->stroke_linejoin = value ? value->linejoin : default_style.stroke_linejoin;
+            break;
+        case ID_FILL_RULE:
+            style->fill_rule = value ? value->winding : default_style.fill_rule;
+            break;
+        case ID_CLIP_RULE:
+            style->clip_rule = value ? value->winding : default_style.clip_rule;
+            break;
+        case ID_VISIBILITY:
+            style->visibility = value ? value->visibility : default_style.visibility;
+            break;
+        default:
+            continue;
+        }
+
+        declared = true;
+    }
+
+    return declared;
+}
+
+static const style_t* create_style(otfsvg_document_t* document, const element_t* element)
+{
+    const element_t* parentelement = element_parent(document, element);
+    const style_t* parent = parentelement ? element_style(parentelement) : &default_style;
+    style_t style;
+    if(!style_cascade(&style, parent, element))
+        return parent;
+    style_t* result = heap_alloc(document->heap, sizeof(style_t));
+    *result = style;
+    return result;
+}
+
+typedef enum {
+    render_mode_display,
+    render_mode_clipping,
+    render_mode_bounding
+} render_mode_t;
+
+typedef struct {
+    const element_t* element;
+    render_mode_t mode;
+    float opacity;
+    otfsvg_matrix_t matrix;
+    otfsvg_rect_t bbox;
+    const element_t* clippath;
+    const style_t* style;
+    style_t cascade;
+    bool compositing;
+} render_state_t;
+
+/*
+ * A group only needs a layer of its own for its opacity when what it paints overlaps. Before pushing one, the group is
+ * rendered dry: the paints and layers it would emit at its own level are collected with their bounds in output units,
+ * a nested layer counting as unbounded. When there are none the group is dropped, and when they are few and pairwise
+ * apart the opacity of the group is passed down to them instead. Paints are apart when more than a pixel separates
+ * them; a display list is replayed at any scale, so while recording one any gap is enough.
+ */
+#define ISOLATION_ITEMS 8
+
+struct isolation {
+    otfsvg_rect_t items[ISOLATION_ITEMS];
+    int count;
+    int limit;
+    int depth;
+    float margin;
+    bool layer;
+    bool overlap;
+};
+
+static void isolation_add(isolation_t* isolation, const otfsvg_rect_t* rect)
+{
+    if(isolation->depth > 0 || isolation->overlap)
+        return;
+    if(isolation->layer || isolation->count == ISOLATION_ITEMS) {
+        isolation->overlap = true;
+        return;
+    }
+
+    for(int i = 0; i < isolation->count; i++) {
+        const otfsvg_rect_t* item = &isolation->items[i];
+        float margin = isolation->margin;
+        if(rect->x <= item->x + item->w + margin && item->x <= rect->x + rect->w + margin
+            && rect->y <= item->y + item->h + margin && item->y <= rect->y + rect->h + margin) {
+            isolation->overlap = true;
+            return;
+        }
+    }
+
+    isolation->items[isolation->count++] = *rect;
+}
+
+/*
+ * Every color of the current paint is also kept as the source it was resolved from, one per gradient stop, so that a
+ * display list can resolve currentColor and palette entries again when it is replayed.
+ */
+struct color_source {
+    color_t color;
+    string_t palette;
+    float opacity;
+};
+
+static otfsvg_color_t source_color(const color_source_t* source, otfsvg_color_t current_color, otfsvg_palette_func_t palette_func, void* palette_data)
+{
+    otfsvg_color_t value = source->color.value;
+    otfsvg_color_t palette;
+    if(source->palette.data && palette_func && palette_func(palette_data, source->palette.data, source->palette.length, &palette)) {
+        value = palette;
+    } else if(source->color.type == color_type_current) {
+        value = current_color;
+    }
+
+    uint32_t rgb = value & 0x00FFFFFF;
+    uint32_t a = source->opacity * otfsvg_alpha_channel(value);
+    return (rgb | a << 24);
+}
+
+/*
+ * A display list holds the canvas calls of one render, recorded against an identity matrix: commands refer by index
+ * to tables of geometry, paints, stroke data and colors owned by the list. Colors are stored together with their
+ * sources, and paints that depend on currentColor or on the palette are resolved again on every replay.
+ */
+typedef enum {
+    display_command_fill,
+    display_command_stroke,
+    display_command_push_group,
+    display_command_pop_group
+} display_command_type_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t mode;
+    uint32_t path;
+    uint32_t paint;
+    uint32_t stroke;
+    float opacity;
+    otfsvg_matrix_t matrix;
+} display_command_t;
+
+typedef struct {
+    uint32_t commands;
+    uint32_t commandcount;
+    uint32_t points;
+    uint32_t pointcount;
+} display_path_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t dynamic;
+    uint32_t colors;
+    uint32_t count;
+    uint32_t gradienttype;
+    uint32_t spread;
+    otfsvg_matrix_t matrix;
+    float x1, y1, x2, y2;
+    float cx, cy, r, fx, fy;
+} display_paint_t;
+
+typedef struct {
+    uint32_t type;
+    otfsvg_color_t value;
+    uint32_t palette;
+    uint32_t length;
+    float opacity;
+} display_color_t;
+
+typedef struct {
+    uint32_t linecap;
+    uint32_t linejoin;
+    float linewidth;
+    float miterlimit;
+    float dashoffset;
+    uint32_t dashes;
+    uint32_t dashcount;
+} display_stroke_t;
+
+struct otfsvg_display_list {
+    otfsvg_matrix_t matrix;
+    otfsvg_rect_t bbox;
+    struct {
+        display_command_t* data;
+        int size;
+        int capacity;
+    } commands;
+    struct {
+        display_path_t* data;
+        int size;
+        int capacity;
+    } paths;
+    struct {
+        otfsvg_path_command_t* data;
+        int size;
+        int capacity;
+    } pathcommands;
+    struct {
+        otfsvg_point_t* data;
+        int size;
+        int capacity;
+    } points;
+    struct {
+        display_paint_t* data;
+        int size;
+        int capacity;
+    } paints;
+    struct {
+        display_color_t* data;
+        int size;
+        int capacity;
+    } colors;
+    struct {
+        otfsvg_gradient_stop_t* data;
+        int size;
+        int capacity;
+    } stops;
+    struct {
+        display_stroke_t* data;
+        int size;
+        int capacity;
+    } strokes;
+    struct {
+        float* data;
+        int size;
+        int capacity;
+    } dashes;
+    struct {
+        char* data;
+        int size;
+        int capacity;
+    } strings;
+    const shape_t* shape;
+};
+
+static uint32_t display_list_add_path(otfsvg_display_list_t* list, const shape_t* shape)
+{
+    if(list->shape == shape)
+        return list->paths.size - 1;
+    otfsvg_path_t data;
+    const otfsvg_path_t* path = &data;
+    shape_path(shape, &data);
+    otfsvg_array_ensure(list->paths, 1);
+    otfsvg_array_ensure(list->pathcommands, path->commands.size);
+    otfsvg_array_ensure(list->points, path->points.size);
+    display_path_t* entry = &list->paths.data[list->paths.size];
+    entry->commands = list->pathcommands.size;
+    entry->commandcount = path->commands.size;
+    entry->points = list->points.size;
+    entry->pointcount = path->points.size;
+    memcpy(list->pathcommands.data + list->pathcommands.size, path->commands.data, path->commands.size * sizeof(otfsvg_path_command_t));
+    memcpy(list->points.data + list->points.size, path->points.data, path->points.size * sizeof(otfsvg_point_t));
+    list->pathcommands.size += path->commands.size;
+    list->points.size += path->points.size;
+    list->shape = shape;
+    return list->paths.size++;
+}
+
+static uint32_t display_list_add_paint(otfsvg_display_list_t* list, const otfsvg_render_context_t* context)
+{
+    const otfsvg_paint_t* paint = &context->paint;
+    const otfsvg_gradient_t* gradient = &paint->gradient;
+    otfsvg_array_ensure(list->paints, 1);
+    otfsvg_array_ensure(list->colors, context->sources.size);
+    otfsvg_array_ensure(list->stops, context->sources.size);
+    display_paint_t* entry = &list->paints.data[list->paints.size];
+    entry->type = paint->type;
+    entry->dynamic = 0;
+    entry->colors = list->colors.size;
+    entry->count = context->sources.size;
+    for(int i = 0; i < context->sources.size; i++) {
+        const color_source_t* source = &context->sources.data[i];
+        display_color_t* color = &list->colors.data[list->colors.size++];
+        otfsvg_gradient_stop_t* stop = &list->stops.data[list->stops.size++];
+        color->type = source->color.type;
+        color->value = source->color.value;
+        color->palette = 0;
+        color->length = 0;
+        color->opacity = source->opacity;
+        if(source->palette.data) {
+            otfsvg_array_ensure(list->strings, (int)(source->palette.length) + 1);
+            memcpy(list->strings.data + list->strings.size, source->palette.data, source->palette.length);
+            color->palette = list->strings.size + 1;
+            color->length = source->palette.length;
+            list->strings.size += source->palette.length;
+        }
+
+        if(color->palette || color->type == color_type_current)
+            entry->dynamic = 1;
+        if(paint->type == otfsvg_paint_type_gradient) {
+            *stop = gradient->stops.data[i];
+        } else {
+            stop->offset = 0.f;
+            stop->color = paint->color;
+        }
+    }
+
+    entry->gradienttype = gradient->type;
+    entry->spread = gradient->spread;
+    entry->matrix = gradient->matrix;
+    entry->x1 = gradient->x1;
+    entry->y1 = gradient->y1;
+    entry->x2 = gradient->x2;
+    entry->y2 = gradient->y2;
+    entry->cx = gradient->cx;
+    entry->cy = gradient->cy;
+    entry->r = gradient->r;
+    entry->fx = gradient->fx;
+    entry->fy = gradient->fy;
+    return list->paints.size++;
+}
+
+static uint32_t display_list_add_stroke(otfsvg_display_list_t* list, const otfsvg_stroke_data_t* strokedata)
+{
+    otfsvg_array_ensure(list->strokes, 1);
+    otfsvg_array_ensure(list->dashes, strokedata->dasharray.size);
+    display_stroke_t* entry = &list->strokes.data[list->strokes.size];
+    entry->linecap = strokedata->linecap;
+    entry->linejoin = strokedata->linejoin;
+    entry->linewidth = strokedata->linewidth;
+    entry->miterlimit = strokedata->miterlimit;
+    entry->dashoffset = strokedata->dashoffset;
+    entry->dashes = list->dashes.size;
+    entry->dashcount = strokedata->dasharray.size;
+    if(strokedata->dasharray.size > 0) {
+        memcpy(list->dashes.data + list->dashes.size, strokedata->dasharray.data, strokedata->dasharray.size * sizeof(float));
+        list->dashes.size += strokedata->dasharray.size;
+    }
+    return list->strokes.size++;
+}
+
+static display_command_t* display_list_add_command(otfsvg_display_list_t* list, display_command_type_t type)
+{
+    otfsvg_array_ensure(list->commands, 1);
+    display_command_t* command = &list->commands.data[list->commands.size++];
+    memset(command, 0, sizeof(display_command_t));
+    command->type = type;
+    return command;
+}
+
+static bool display_list_record_path(otfsvg_render_context_t* context, const render_state_t* state, display_command_type_t type, otfsvg_fill_rule_t winding)
+{
+    otfsvg_display_list_t* list = context->recorder;
+    uint32_t path = display_list_add_path(list, element_shape(state->element));
+    uint32_t paint = display_list_add_paint(list, context);
+    display_command_t* command = display_list_add_command(list, type);
+    command->mode = winding;
+    command->path = path;
+    command->paint = paint;
+    command->matrix = state->matrix;
+    if(type == display_command_stroke)
+        command->stroke = display_list_add_stroke(list, &context->strokedata);
+    return true;
+}
+
+static bool display_list_record_group(otfsvg_render_context_t* context, display_command_type_t type, float opacity, otfsvg_blend_mode_t mode)
+{
+    display_command_t* command = display_list_add_command(context->recorder, type);
+    command->mode = mode;
+    command->opacity = opacity;
+    return true;
+}
+
+static bool document_fill_path(otfsvg_render_context_t* context, const render_state_t* state, otfsvg_fill_rule_t winding)
+{
+    if(context->recorder)
+        return display_list_record_path(context, state, display_command_fill, winding);
+    otfsvg_canvas_t* canvas = context->canvas;
+    otfsvg_path_t path;
+    shape_path(element_shape(state->element), &path);
     if(canvas && canvas->fill_path)
-        return canvas->fill_path(document->canvas_data, &document->path, &state->matrix, winding, &document->paint);
+        return canvas->fill_path(context->canvas_data, &path, &state->matrix, winding, &context->paint);
     return false;
 }
 
-static bool document_stroke_path(const otfsvg_document_t* document, const render_state_t* state)
+static bool document_stroke_path(otfsvg_render_context_t* context, const render_state_t* state)
 {
-    otfsvg_canvas_t* canvas = document->canvas;
+    if(context->recorder)
+        return display_list_record_path(context, state, display_command_stroke, otfsvg_fill_rule_non_zero);
+    otfsvg_canvas_t* canvas = context->canvas;
+    otfsvg_path_t path;
+    shape_path(element_shape(state->element), &path);
     if(canvas && canvas->stroke_path)
-        return canvas->stroke_path(document->canvas_data, &document->path, &state->matrix, &document->strokedata, &document->paint);
+        return canvas->stroke_path(context->canvas_data, &path, &state->matrix, &context->strokedata, &context->paint);
     return false;
 }
 
-static bool document_push_group(otfsvg_document_t* document, float opacity, otfsvg_blend_mode_t mode)
+static bool document_push_group(otfsvg_render_context_t* context, float opacity, otfsvg_blend_mode_t mode)
 {
-    otfsvg_canvas_t* canvas = document->canvas;
+    isolation_t* isolation = context->isolation;
+    if(isolation) {
+        if(isolation->depth == 0) {
+            isolation->overlap |= isolation->count > 0;
+            isolation->layer = true;
+            isolation->count++;
+        }
+
+        isolation->depth++;
+        return true;
+    }
+
+    context->stats.layers++;
+    if(context->recorder)
+        return display_list_record_group(context, display_command_push_group, opacity, mode);
+    otfsvg_canvas_t* canvas = context->canvas;
     if(canvas && canvas->push_group)
-        return canvas->push_group(document->canvas_data, opacity, mode);
+        return canvas->push_group(context->canvas_data, opacity, mode);
     return false;
 }
 
-static bool document_pop_group(otfsvg_document_t* document, float opacity, otfsvg_blend_mode_t mode)
+static bool document_pop_group(otfsvg_render_context_t* context, float opacity, otfsvg_blend_mode_t mode)
 {
-    otfsvg_canvas_t* canvas = document->canvas;
+    if(context->isolation) {
+        context->isolation->depth--;
+        return true;
+    }
+
+    if(context->recorder)
+        return display_list_record_group(context, display_command_pop_group, opacity, mode);
+    otfsvg_canvas_t* canvas = context->canvas;
     if(canvas && canvas->pop_group)
-        return canvas->pop_group(document->canvas_data, opacity, mode);
+        return canvas->pop_group(context->canvas_data, opacity, mode);
     return false;
 }
 
-static bool document_decode_image(otfsvg_document_t* document, const string_t* href, otfsvg_image_t* image)
+static bool document_decode_image(otfsvg_render_context_t* context, const string_t* href, otfsvg_image_t* image)
 {
-    otfsvg_canvas_t* canvas = document->canvas;
+    otfsvg_canvas_t* canvas = context->canvas;
     if(canvas && canvas->decode_image)
-        return canvas->decode_image(document->canvas_data, href->data, href->length, image);
+        return canvas->decode_image(context->canvas_data, href->data, href->length, image);
     return false;
 }
 
-static bool document_draw_image(otfsvg_document_t* document, const render_state_t* state, const otfsvg_image_t* image, const otfsvg_rect_t* clip)
+static bool document_draw_image(otfsvg_render_context_t* context, const render_state_t* state, const otfsvg_image_t* image, const otfsvg_rect_t* clip)
 {
-    otfsvg_canvas_t* canvas = document->canvas;
+    otfsvg_canvas_t* canvas = context->canvas;
     if(canvas && canvas->draw_image)
-        return canvas->draw_image(document->canvas_data, image, &state->matrix, clip, state->opacity);
+        return canvas->draw_image(context->canvas_data, image, &state->matrix, clip, state->opacity);
     return false;
 }
 
-static bool document_get_palette(otfsvg_document_t* document, const string_t* id, otfsvg_color_t* color)
-{
-    if(document->palette_func == NULL)
-        return false;
-    return document->palette_func(document->palette_data, id->data, id->length, color);
-}
-
-static element_t* resolve_iri(const otfsvg_document_t* document, element_t* element, int id);
+static const element_t* resolve_iri(otfsvg_render_context_t* context, const element_t* element, int id);
+static bool render_isolate(otfsvg_render_context_t* context, render_state_t* state, bool grouping, bool* empty);
 
-static void render_state_begin(otfsvg_document_t* document, render_state_t* state, render_state_t* newstate, otfsvg_blend_mode_t mode)
+static bool render_state_begin(otfsvg_render_context_t* context, render_state_t* state, render_state_t* newstate, otfsvg_blend_mode_t mode)
 {
-    element_t* element = newstate->element;
+    const element_t* element = newstate->element;
     float opacity = 1.f;
 
     if(newstate->mode == render_mode_display)
-        parse_number(element, ID_OPACITY, &opacity, true, false);
-    parse_transform(element, ID_TRANSFORM, &newstate->matrix);
+        get_number(element, ID_OPACITY, &opacity);
+    get_transform(element, ID_TRANSFORM, &newstate->matrix);
+
+    newstate->style = element_style(element);
+    if(context->overrides && state->element == context_parent(context, element)) {
+        newstate->style = state->style;
+        if(style_cascade(&newstate->cascade, state->style, element)) {
+            newstate->style = &newstate->cascade;
+        }
+    }
+
     otfsvg_matrix_multiply(&newstate->matrix, &newstate->matrix, &state->matrix);
 
     otfsvg_rect_init(&newstate->bbox, FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX);
-    newstate->clippath = resolve_iri(document, element, ID_CLIP_PATH);
-    newstate->opacity = opacity;
+    newstate->clippath = resolve_iri(context, element, ID_CLIP_PATH);
+    newstate->opacity = state->compositing ? opacity : opacity * state->opacity;
     newstate->compositing = false;
     if(newstate->mode == render_mode_bounding)
-        return;
-    if(mode == otfsvg_blend_mode_dst_in || newstate->clippath || (opacity < 1.f && element->firstchild)) {
-        document_push_group(document, opacity, mode);
+        return true;
+
+    bool compositing = mode == otfsvg_blend_mode_dst_in || newstate->clippath;
+    bool grouping = opacity < 1.f && (element->id == TAG_USE || has_children(context->document, element));
+    opacity = newstate->opacity;
+    if(newstate->mode == render_mode_display && context->isolation == NULL && (compositing || grouping)) {
+        bool empty = opacity <= 0.f;
+        bool isolated = empty || render_isolate(context, newstate, grouping, &empty);
+        if(empty) {
+            context->stats.empty_layers++;
+            return false;
+        }
+
+        if(grouping && !compositing && !isolated) {
+            context->stats.folded_layers++;
+            grouping = false;
+        }
+    }
+
+    if(opacity <= 0.f)
+        return false;
+    if(compositing || grouping) {
+        document_push_group(context, opacity, mode);
         newstate->compositing = true;
     }
+
+    return true;
 }
 
-static void render_clip_path(otfsvg_document_t* document, render_state_t* state, element_t* element);
+static void render_clip_path(otfsvg_render_context_t* context, render_state_t* state, const element_t* element);
 
-static void render_state_end(otfsvg_document_t* document, render_state_t* state, render_state_t* newstate, otfsvg_blend_mode_t mode)
+static void render_state_end(otfsvg_render_context_t* context, render_state_t* state, render_state_t* newstate, otfsvg_blend_mode_t mode)
 {
     if(newstate->clippath)
-        render_clip_path(document, newstate, newstate->clippath);
+        render_clip_path(context, newstate, newstate->clippath);
     if(newstate->compositing)
-        document_pop_group(document, newstate->opacity, mode);
+        document_pop_group(context, newstate->opacity, mode);
 
     otfsvg_matrix_t matrix = state->matrix;
     otfsvg_matrix_invert(&matrix);
@@ -2294,7 +3827,7 @@ static void render_state_end(otfsvg_document_t* document, render_state_t* state,
     }
 }
 
-static float resolve_length(const otfsvg_document_t* document, const length_t* length, char mode)
+static float document_length(const otfsvg_document_t* document, const length_t* length, char mode)
 {
     if(length->type == length_type_percent) {
         float w = document->width;
@@ -2306,78 +3839,170 @@ static float resolve_length(const otfsvg_document_t* document, const length_t* l
     return convert_length(length, 1.f, document->dpi);
 }
 
-static element_t* find_element(const otfsvg_document_t* document, const string_t* id)
+static float resolve_length(otfsvg_render_context_t* context, const length_t* length, char mode)
+{
+    return document_length(context->document, length, mode);
+}
+
+/*
+ * A document image is a loaded document laid out in one position-independent buffer: a header, the element block of
+ * the whole tree, the style records, the shapes, then the id table sorted by id and the glyph table, every link being
+ * an offset relative to the image or to the record holding it. A document loaded from an image renders straight from
+ * the buffer, so one read-only mapping of an image can back documents in any number of processes. Property values and
+ * ids stay offsets into the document text, which is embedded for compressed documents and supplied by the caller
+ * otherwise.
+ */
+#define IMAGE_MAGIC "OTFSVGI"
+#define IMAGE_VERSION 1
+#define IMAGE_BYTE_ORDER 0x01020304
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteorder;
+    uint64_t length;
+    uint64_t sourcehash;
+    uint32_t sourcelength;
+    uint32_t text;
+    uint32_t elements;
+    uint32_t elementcount;
+    uint32_t propertycount;
+    uint32_t valuecount;
+    uint32_t styles;
+    uint32_t stylecount;
+    uint32_t shapes;
+    uint32_t shapesize;
+    uint32_t ids;
+    uint32_t idcount;
+    uint32_t glyphs;
+    uint32_t glyphcount;
+    int32_t glyphbase;
+    float width;
+    float height;
+    float dpi;
+} image_header_t;
+
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+    uint32_t element;
+} image_id_t;
+
+static int image_compare_id(const char* source, const image_id_t* entry, const char* data, size_t length)
+{
+    int result = memcmp(source + entry->offset, data, otfsvg_min(entry->length, length));
+    if(result == 0 && entry->length != length)
+        return entry->length < length ? -1 : 1;
+    return result;
+}
+
+static const element_t* image_find_element(const otfsvg_document_t* document, const char* data, size_t length)
+{
+    const image_header_t* header = (const image_header_t*)(document->image);
+    const image_id_t* ids = (const image_id_t*)(document->image + header->ids);
+    int lo = 0;
+    int hi = (int)(header->idcount) - 1;
+    while(lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        int result = image_compare_id(document->source, &ids[mid], data, length);
+        if(result < 0)
+            lo = mid + 1;
+        else if(result > 0)
+            hi = mid - 1;
+        else
+            return document->root + ids[mid].element;
+    }
+
+    return NULL;
+}
+
+static const element_t* image_find_glyph(const otfsvg_document_t* document, int index)
 {
+    const image_header_t* header = (const image_header_t*)(document->image);
+    const uint32_t* glyphs = (const uint32_t*)(document->image + header->glyphs);
+    if(index < 0 || index >= (int)(header->glyphcount) || glyphs[index] == 0)
+        return NULL;
+    return document->root + glyphs[index] - 1;
+}
+
+static const element_t* find_element(const otfsvg_document_t* document, const string_t* id)
+{
+    if(document->image)
+        return image_find_element(document, id->data, id->length);
     return hashmap_get(document->idcache, id->data, id->length);
 }
 
-static element_t* resolve_iri(const otfsvg_document_t* document, element_t* element, int id)
+static const element_t* resolve_iri(otfsvg_render_context_t* context, const element_t* element, int id)
 {
-    const string_t* value = find_property(element, id, false);
-    if(value && value->length > 1 && value->data[0] == '#') {
-        string_t id = {value->data + 1, value->length - 1};
-        return find_element(document, &id);
+    string_t value;
+    if(find_property(context->document, element, id, &value) && value.length > 1 && value.data[0] == '#') {
+        string_t id = {value.data + 1, value.length - 1};
+        return find_element(context->document, &id);
     }
 
     return NULL;
 }
 
-static otfsvg_color_t resolve_color(const otfsvg_document_t* document, const color_t* color, float opacity)
+static otfsvg_color_t resolve_color(otfsvg_render_context_t* context, const color_t* color, const string_t* palette, float opacity)
 {
-    otfsvg_color_t value = color->value;
-    if(color->type == color_type_current)
-        value = document->current_color;
-    uint32_t rgb = value & 0x00FFFFFF;
-    uint32_t a = opacity * otfsvg_alpha_channel(value);
-    return (rgb | a << 24);
+    otfsvg_array_ensure(context->sources, 1);
+    color_source_t* source = &context->sources.data[context->sources.size++];
+    source->color = *color;
+    source->palette.data = palette ? palette->data : NULL;
+    source->palette.length = palette ? palette->length : 0;
+    source->opacity = opacity;
+    return source_color(source, context->current_color, context->palette_func, context->palette_data);
+}
+
+static bool resolve_paint_color(otfsvg_render_context_t* context, const color_t* color, const string_t* palette, float opacity)
+{
+    context->sources.size = 0;
+    context->paint.type = otfsvg_paint_type_color;
+    context->paint.color = resolve_color(context, color, palette, opacity);
+    return true;
 }
 
-static float resolve_gradient_length(const otfsvg_document_t* document, const length_t* length, int units, char mode)
+static float resolve_gradient_length(otfsvg_render_context_t* context, const length_t* length, int units, char mode)
 {
     if(units == units_type_object_bounding_box)
-        return convert_length(length, 1.f, document->dpi);
-    return resolve_length(document, length, mode);
+        return convert_length(length, 1.f, context->document->dpi);
+    return resolve_length(context, length, mode);
 }
 
-static void resolve_gradient_stop(const otfsvg_document_t* document, otfsvg_gradient_t* gradient, float opacity, element_t* element)
+static void resolve_gradient_stop(otfsvg_render_context_t* context, otfsvg_gradient_t* gradient, float opacity, const element_t* element)
 {
     float offset = 0;
-    float stop_opacity = 1.f;
-    color_t stop_color = {color_type_fixed, otfsvg_black_color};
-
-    parse_number(element, ID_OFFSET, &offset, true, false);
-    parse_number(element, ID_STOP_OPACITY, &stop_opacity, true, true);
-    parse_color(element, ID_STOP_COLOR, &stop_color);
+    get_number(element, ID_OFFSET, &offset);
 
+    const style_t* style = element_style(element);
     otfsvg_array_ensure(gradient->stops, 1);
     otfsvg_gradient_stop_t* stop = &gradient->stops.data[gradient->stops.size];
     stop->offset = offset;
-    stop->color = resolve_color(document, &stop_color, opacity * stop_opacity);
+    stop->color = resolve_color(context, &style->stop_color, NULL, opacity * style->stop_opacity);
     gradient->stops.size += 1;
 }
 
-static void resolve_gradient_stops(const otfsvg_document_t* document, otfsvg_gradient_t* gradient, float opacity, element_t* element)
+static void resolve_gradient_stops(otfsvg_render_context_t* context, otfsvg_gradient_t* gradient, float opacity, const element_t* element)
 {
     otfsvg_array_clear(gradient->stops);
-    element_t* child = element->firstchild;
-    while(child) {
-        if(child->id == TAG_STOP)
-            resolve_gradient_stop(document, gradient, opacity, child);
-        child = child->nextchild;
+    otfsvg_array_clear(context->sources);
+    const element_t* end = element + element->end;
+    for(const element_t* child = element + 1; child < end; child += child->end) {
+        if(child->id == TAG_STOP) {
+            resolve_gradient_stop(context, gradient, opacity, child);
+        }
     }
 }
 
-static void fill_gradient_elements(element_t* current, element_t** elements)
+static void fill_gradient_elements(const element_t* current, const element_t** elements)
 {
     if(elements[0] == NULL) {
-        element_t* child = current->firstchild;
-        while(child) {
+        const element_t* end = current + current->end;
+        for(const element_t* child = current + 1; child < end; child += child->end) {
             if(child->id == TAG_STOP) {
                 elements[0] = current;
                 break;
             }
-
-            child = child->nextchild;
         }
     }
 
@@ -2389,11 +4014,11 @@ static void fill_gradient_elements(element_t* current, element_t** elements)
         elements[3] = current;
 }
 
-static bool resolve_linear_gradient(otfsvg_document_t* document, render_state_t* state, element_t* element, float opacity)
+static bool resolve_linear_gradient(otfsvg_render_context_t* context, render_state_t* state, const element_t* element, float opacity)
 {
-    element_t* elements[8];
+    const element_t* elements[8];
     memset(elements, 0, sizeof(elements));
-    element_t* current = element;
+    const element_t* current = element;
     while(true) {
         fill_gradient_elements(current, elements);
         if(current->id == TAG_LINEAR_GRADIENT) {
@@ -2407,7 +4032,7 @@ static bool resolve_linear_gradient(otfsvg_document_t* document, render_state_t*
                 elements[7] = current;
         }
 
-        element_t* ref = resolve_iri(document, current, ID_XLINK_HREF);
+        const element_t* ref = resolve_iri(context, current, ID_XLINK_HREF);
         if(ref == NULL || !(ref->id == TAG_LINEAR_GRADIENT || ref->id == TAG_RADIAL_GRADIENT))
             break;
         current = ref;
@@ -2421,7 +4046,7 @@ static bool resolve_linear_gradient(otfsvg_document_t* document, render_state_t*
         }
     }
 
-    otfsvg_paint_t* paint = &document->paint;
+    otfsvg_paint_t* paint = &context->paint;
     otfsvg_gradient_t* gradient = &paint->gradient;
 
     paint->type = otfsvg_paint_type_gradient;
@@ -2431,10 +4056,10 @@ static bool resolve_linear_gradient(otfsvg_document_t* document, render_state_t*
     units_type_t units = units_type_object_bounding_box;
     otfsvg_gradient_spread_t spread = otfsvg_gradient_spread_pad;
 
-    resolve_gradient_stops(document, gradient, opacity, elements[0]);
-    parse_transform(elements[1], ID_GRADIENT_TRANSFORM, &matrix);
-    parse_units(elements[2], ID_GRADIENT_UNITS, &units);
-    parse_gradient_spread(elements[3], ID_SPREAD_METHOD, &spread);
+    resolve_gradient_stops(context, gradient, opacity, elements[0]);
+    get_transform(elements[1], ID_GRADIENT_TRANSFORM, &matrix);
+    get_units(elements[2], ID_GRADIENT_UNITS, &units);
+    get_gradient_spread(elements[3], ID_SPREAD_METHOD, &spread);
     if(units == units_type_object_bounding_box) {
         otfsvg_matrix_t m;
         otfsvg_matrix_init_translate(&m, state->bbox.x, state->bbox.y);
@@ -2450,23 +4075,25 @@ static bool resolve_linear_gradient(otfsvg_document_t* document, render_state_t*
     length_t x2 = {100, length_type_percent};
     length_t y2 = {0, length_type_px};
 
-    parse_length(elements[4], ID_X1, &x1, true, false);
-    parse_length(elements[5], ID_Y1, &y1, true, false);
-    parse_length(elements[6], ID_X2, &x2, true, false);
-    parse_length(elements[7], ID_Y2, &y2, true, false);
-
-    gradient->x1 = resolve_gradient_length(document, &x1, units, 'x');
-    gradient->y1 = resolve_gradient_length(document, &y1, units, 'y');
-    gradient->x2 = resolve_gradient_length(document, &x2, units, 'x');
-    gradient->y2 = resolve_gradient_length(document, &y2, units, 'y');
+    get_length(elements[4], ID_X1, &x1);
+    get_length(elements[5], ID_Y1, &y1);
+    get_length(elements[6], ID_X2, &x2);
+    get_length(elements[7], ID_Y2, &y2);
+
+    gradient->x1 = resolve_gradient_length(context, &x1, units, 'x');
+    gradient->y1 = resolve_gradient_length(context, &y1, units, 'y');
+    gradient->x2 = resolve_gradient_length(context, &x2, units, 'x');
+    gradient->y2 = resolve_gradient_length(context, &y2, units, 'y');
+    gradient->cx = gradient->cy = gradient->r = 0.f;
+    gradient->fx = gradient->fy = 0.f;
     return true;
 }
 
-static bool resolve_radial_gradient(otfsvg_document_t* document, render_state_t* state, element_t* element, float opacity)
+static bool resolve_radial_gradient(otfsvg_render_context_t* context, render_state_t* state, const element_t* element, float opacity)
 {
-    element_t* elements[9];
+    const element_t* elements[9];
     memset(elements, 0, sizeof(elements));
-    element_t* current = element;
+    const element_t* current = element;
     while(true) {
         fill_gradient_elements(current, elements);
         if(current->id == TAG_RADIAL_GRADIENT) {
@@ -2482,7 +4109,7 @@ static bool resolve_radial_gradient(otfsvg_document_t* document, render_state_t*
                 elements[8] = current;
         }
 
-        element_t* ref = resolve_iri(document, current, ID_XLINK_HREF);
+        const element_t* ref = resolve_iri(context, current, ID_XLINK_HREF);
         if(ref == NULL || !(ref->id == TAG_LINEAR_GRADIENT || ref->id == TAG_RADIAL_GRADIENT))
             break;
         current = ref;
@@ -2498,7 +4125,7 @@ static bool resolve_radial_gradient(otfsvg_document_t* document, render_state_t*
         }
     }
 
-    otfsvg_paint_t* paint = &document->paint;
+    otfsvg_paint_t* paint = &context->paint;
     otfsvg_gradient_t* gradient = &paint->gradient;
 
     paint->type = otfsvg_paint_type_gradient;
@@ -2508,10 +4135,10 @@ static bool resolve_radial_gradient(otfsvg_document_t* document, render_state_t*
     units_type_t units = units_type_object_bounding_box;
     otfsvg_gradient_spread_t spread = otfsvg_gradient_spread_pad;
 
-    resolve_gradient_stops(document, gradient, opacity, elements[0]);
-    parse_transform(elements[1], ID_GRADIENT_TRANSFORM, &matrix);
-    parse_units(elements[2], ID_GRADIENT_UNITS, &units);
-    parse_gradient_spread(elements[3], ID_SPREAD_METHOD, &spread);
+    resolve_gradient_stops(context, gradient, opacity, elements[0]);
+    get_transform(elements[1], ID_GRADIENT_TRANSFORM, &matrix);
+    get_units(elements[2], ID_GRADIENT_UNITS, &units);
+    get_gradient_spread(elements[3], ID_SPREAD_METHOD, &spread);
     if(units == units_type_object_bounding_box) {
         otfsvg_matrix_t m;
         otfsvg_matrix_init_translate(&m, state->bbox.x, state->bbox.y);
@@ -2528,210 +4155,211 @@ static bool resolve_radial_gradient(otfsvg_document_t* document, render_state_t*
     length_t fx = {50, length_type_percent};
     length_t fy = {50, length_type_percent};
 
-    parse_length(elements[4], ID_CX, &cx, true, false);
-    parse_length(elements[5], ID_CY, &cy, true, false);
-    parse_length(elements[6], ID_R, &r, false, false);
-    parse_length(elements[7], ID_FX, &fx, true, false);
-    parse_length(elements[8], ID_FY, &fy, true, false);
-
-    gradient->cx = resolve_gradient_length(document, &cx, units, 'x');
-    gradient->cy = resolve_gradient_length(document, &cy, units, 'y');
-    gradient->r = resolve_gradient_length(document, &r, units, 'o');
-    gradient->fx = resolve_gradient_length(document, &fx, units, 'x');
-    gradient->fy = resolve_gradient_length(document, &fy, units, 'y');
+    get_length(elements[4], ID_CX, &cx);
+    get_length(elements[5], ID_CY, &cy);
+    get_length(elements[6], ID_R, &r);
+    get_length(elements[7], ID_FX, &fx);
+    get_length(elements[8], ID_FY, &fy);
+
+    gradient->cx = resolve_gradient_length(context, &cx, units, 'x');
+    gradient->cy = resolve_gradient_length(context, &cy, units, 'y');
+    gradient->r = resolve_gradient_length(context, &r, units, 'o');
+    gradient->fx = resolve_gradient_length(context, &fx, units, 'x');
+    gradient->fy = resolve_gradient_length(context, &fy, units, 'y');
+    gradient->x1 = gradient->y1 = 0.f;
+    gradient->x2 = gradient->y2 = 0.f;
     return true;
 }
 
-static bool resolve_solid_color(otfsvg_document_t* document, element_t* element, float opacity)
+static bool resolve_solid_color(otfsvg_render_context_t* context, const element_t* element, float opacity)
 {
-    float solid_opacity = 1.f;
-    color_t solid_color = {color_type_fixed, otfsvg_black_color};
-
-    parse_number(element, ID_SOLID_OPACITY, &solid_opacity, true, true);
-    parse_color(element, ID_SOLID_COLOR, &solid_color);
-
-    document->paint.type = otfsvg_paint_type_color;
-    document->paint.color = resolve_color(document, &solid_color, opacity * solid_opacity);
-    return true;
+    const style_t* style = element_style(element);
+    return resolve_paint_color(context, &style->solid_color, NULL, opacity * style->solid_opacity);
 }
 
-static bool resolve_paint(otfsvg_document_t* document, render_state_t* state, const paint_t* paint, float opacity)
+static bool resolve_paint(otfsvg_render_context_t* context, render_state_t* state, const paint_t* paint, float opacity)
 {
     if(paint->type == paint_type_none)
         return false;
-    if(paint->type == paint_type_color) {
-        document->paint.type = otfsvg_paint_type_color;
-        document->paint.color = resolve_color(document, &paint->color, opacity);
-        return true;
-    }
+    if(paint->type == paint_type_color)
+        return resolve_paint_color(context, &paint->color, NULL, opacity);
+    string_t id = {context->document->source + paint->idoffset, paint->idlength};
+    if(paint->type == paint_type_var)
+        return resolve_paint_color(context, &paint->color, &id, opacity);
 
-    if(paint->type == paint_type_var) {
-        color_t color = {color_type_fixed, otfsvg_transparent_color};
-        if(!document_get_palette(document, &paint->id, &color.value))
-            color = paint->color;
-        document->paint.type = otfsvg_paint_type_color;
-        document->paint.color = resolve_color(document, &color, opacity);;
-    }
-
-    element_t* ref = find_element(document, &paint->id);
-    if(ref == NULL) {
-        document->paint.type = otfsvg_paint_type_color;
-        document->paint.color = resolve_color(document, &paint->color, opacity);
-        return true;
-    }
+    const element_t* ref = find_element(context->document, &id);
+    if(ref == NULL)
+        return resolve_paint_color(context, &paint->color, NULL, opacity);
 
     if(ref->id == TAG_SOLID_COLOR)
-        return resolve_solid_color(document, ref, opacity);
+        return resolve_solid_color(context, ref, opacity);
     if(ref->id == TAG_LINEAR_GRADIENT)
-        return resolve_linear_gradient(document, state, ref, opacity);
+        return resolve_linear_gradient(context, state, ref, opacity);
     if(ref->id == TAG_RADIAL_GRADIENT)
-        return resolve_radial_gradient(document, state, ref, opacity);
+        return resolve_radial_gradient(context, state, ref, opacity);
     return false;
 }
 
-static bool resolve_fill(otfsvg_document_t* document, render_state_t* state)
+static bool resolve_fill(otfsvg_render_context_t* context, render_state_t* state)
 {
-    element_t* element = state->element;
-    paint_t fill = {paint_type_color, {color_type_fixed, otfsvg_black_color}};
-    float opacity = 1.f;
-
-    parse_paint(element, ID_FILL, &fill);
-    parse_number(element, ID_FILL_OPACITY, &opacity, true, true);
-    return resolve_paint(document, state, &fill, opacity * state->opacity);
+    const style_t* style = state->style;
+    return resolve_paint(context, state, &style->fill, style->fill_opacity * state->opacity);
 }
 
-static bool resolve_stroke(otfsvg_document_t* document, render_state_t* state)
+static bool resolve_stroke(otfsvg_render_context_t* context, render_state_t* state)
 {
-    element_t* element = state->element;
-    paint_t stroke = {paint_type_none, {color_type_fixed, otfsvg_transparent_color}};
-    float opacity = 1.f;
-
-    parse_paint(element, ID_STROKE, &stroke);
-    parse_number(element, ID_STROKE_OPACITY, &opacity, true, true);
-    return resolve_paint(document, state, &stroke, opacity * state->opacity);
+    const style_t* style = state->style;
+    return resolve_paint(context, state, &style->stroke, style->stroke_opacity * state->opacity);
 }
 
-static void resolve_stroke_data(otfsvg_document_t* document, render_state_t* state)
+static void resolve_stroke_data(otfsvg_render_context_t* context, render_state_t* state)
 {
-    element_t* element = state->element;
-    otfsvg_line_cap_t linecap = otfsvg_line_cap_butt;
-    otfsvg_line_join_t linejoin = otfsvg_line_join_miter;
-
-    parse_line_cap(element, ID_STROKE_LINECAP, &linecap);
-    parse_line_join(element, ID_STROKE_LINEJOIN, &linejoin);
-
-    float miterlimit = 4.f;
-    length_t linewidth = {1, length_type_number};
-    length_t dashoffset = {0, length_type_number};
-
-    parse_number(element, ID_STROKE_MITERLIMIT, &miterlimit, false, true);
-    parse_length(element, ID_STROKE_WIDTH, &linewidth, false, true);
-    parse_length(element, ID_STROKE_DASHOFFSET, &dashoffset, true, true);
-
-    otfsvg_stroke_data_t* strokedata = &document->strokedata;
-    strokedata->linecap = linecap;
-    strokedata->linejoin = linejoin;
-    strokedata->miterlimit = miterlimit;
-    strokedata->linewidth = resolve_length(document, &linewidth, 'o');
-    strokedata->dashoffset = resolve_length(document, &dashoffset, 'o');
+    const element_t* element = state->element;
+    const style_t* style = state->style;
+    otfsvg_stroke_data_t* strokedata = &context->strokedata;
+    strokedata->linecap = style->stroke_linecap;
+    strokedata->linejoin = style->stroke_linejoin;
+    strokedata->miterlimit = style->stroke_miterlimit;
+    strokedata->linewidth = resolve_length(context, &style->stroke_width, 'o');
+    strokedata->dashoffset = resolve_length(context, &style->stroke_dashoffset, 'o');
     strokedata->dasharray.size = 0;
-    const string_t* value = find_property(element, ID_STROKE_DASHARRAY, false);
-    if(value == NULL)
+    string_t value;
+    if(!find_property(context->document, element, ID_STROKE_DASHARRAY, &value))
         return;
-    const char* it = value->data;
-    const char* end = it + value->length;
+    const char* it = value.data;
+    const char* end = it + value.length;
     while(it < end) {
         length_t dash = {0, length_type_unknown};
         if(!parse_length_value(&it, end, &dash, false))
             break;
         otfsvg_array_ensure(strokedata->dasharray, 1);
         float* data = strokedata->dasharray.data;
-        data[strokedata->dasharray.size] = resolve_length(document, &dash, 'o');
+        data[strokedata->dasharray.size] = resolve_length(context, &dash, 'o');
         strokedata->dasharray.size += 1;
         skip_ws_comma(&it, end);
     }
 }
 
-static void document_draw(otfsvg_document_t* document, render_state_t* state)
+static void stroke_bounds(otfsvg_render_context_t* context, render_state_t* state, otfsvg_rect_t* rect)
+{
+    resolve_stroke_data(context, state);
+    otfsvg_stroke_data_t* strokedata = &context->strokedata;
+    float caplimit = strokedata->linewidth / 2.f;
+    if(strokedata->linecap == otfsvg_line_cap_square)
+        caplimit *= otfsvg_sqrt2;
+
+    float joinlimit = strokedata->linewidth / 2.f;
+    if(strokedata->linejoin == otfsvg_line_join_miter)
+        joinlimit *= strokedata->miterlimit;
+
+    float delta = otfsvg_max(caplimit, joinlimit);
+    rect->x = state->bbox.x - delta;
+    rect->y = state->bbox.y - delta;
+    rect->w = state->bbox.w + delta * 2.f;
+    rect->h = state->bbox.h + delta * 2.f;
+}
+
+static void document_draw(otfsvg_render_context_t* context, render_state_t* state)
 {
-    element_t* element = state->element;
+    const style_t* style = state->style;
     if(state->mode == render_mode_bounding) {
-        paint_t paint = {paint_type_none};
-        parse_paint(element, ID_STROKE, &paint);
-        if(paint.type == paint_type_none)
-            return;
-        resolve_stroke_data(document, state);
-        otfsvg_stroke_data_t* strokedata = &document->strokedata;
-        float caplimit = strokedata->linewidth / 2.f;
-        if(strokedata->linecap == otfsvg_line_cap_square)
-            caplimit *= otfsvg_sqrt2;
-
-        float joinlimit = strokedata->linewidth / 2.f;
-        if(strokedata->linejoin == otfsvg_line_join_miter)
-            joinlimit *= strokedata->miterlimit;
-
-        float delta = otfsvg_max(caplimit, joinlimit);
-        state->bbox.x -= delta;
-        state->bbox.y -= delta;
-        state->bbox.w += delta * 2.f;
-        state->bbox.h += delta * 2.f;
+        if(style->stroke.type != paint_type_none)
+            stroke_bounds(context, state, &state->bbox);
         return;
     }
 
-    visibility_t visibility = visibility_visible;
-    parse_visibility(element, ID_VISIBILITY, &visibility);
-    if(visibility == visibility_hidden)
+    if(style->visibility == visibility_hidden)
         return;
-    if(state->mode == render_mode_clipping) {
-        otfsvg_fill_rule_t winding = otfsvg_fill_rule_non_zero;
-        parse_winding(element, ID_CLIP_RULE, &winding);
+    if(context->isolation) {
+        if(state->mode == render_mode_clipping)
+            return;
+        otfsvg_rect_t rect;
+        if(style->fill.type != paint_type_none) {
+            otfsvg_matrix_map_rect(&state->matrix, &state->bbox, &rect);
+            isolation_add(context->isolation, &rect);
+        }
+
+        if(style->stroke.type != paint_type_none) {
+            stroke_bounds(context, state, &rect);
+            otfsvg_matrix_map_rect(&state->matrix, &rect, &rect);
+            isolation_add(context->isolation, &rect);
+        }
 
-        document->paint.type = otfsvg_paint_type_color;
-        document->paint.color = otfsvg_black_color;
-        document_fill_path(document, state, winding);
         return;
     }
 
-    if(resolve_fill(document, state)) {
-        otfsvg_fill_rule_t winding = otfsvg_fill_rule_non_zero;
-        parse_winding(element, ID_FILL_RULE, &winding);
-        document_fill_path(document, state, winding);
+    if(state->mode == render_mode_clipping) {
+        static const color_t black = {color_type_fixed, otfsvg_black_color};
+        resolve_paint_color(context, &black, NULL, 1.f);
+        document_fill_path(context, state, style->clip_rule);
+        return;
     }
 
-    if(resolve_stroke(document, state)) {
-        resolve_stroke_data(document, state);
-        document_stroke_path(document, state);
+    if(resolve_fill(context, state))
+        document_fill_path(context, state, style->fill_rule);
+
+    if(resolve_stroke(context, state)) {
+        resolve_stroke_data(context, state);
+        document_stroke_path(context, state);
     }
 }
 
-static bool is_display_none(element_t* element)
+static bool is_display_none(const element_t* element)
 {
     display_t display = display_inline;
-    parse_display(element, ID_DISPLAY, &display);
+    get_display(element, ID_DISPLAY, &display);
     return display == display_none;
 }
 
-static void render_element(otfsvg_document_t* document, render_state_t* state, element_t* element);
-static void render_children(otfsvg_document_t* document, render_state_t* state, element_t* element);
+static void render_element(otfsvg_render_context_t* context, render_state_t* state, const element_t* element);
+static void render_children(otfsvg_render_context_t* context, render_state_t* state, const element_t* element);
 
-static void render_clip_path(otfsvg_document_t* document, render_state_t* state, element_t* element)
+static void render_clip_path(otfsvg_render_context_t* context, render_state_t* state, const element_t* element)
 {
     units_type_t units = units_type_user_space_on_use;
-    parse_units(element, ID_CLIP_PATH_UNITS, &units);
+    get_units(element, ID_CLIP_PATH_UNITS, &units);
 
     render_state_t newstate = {element, render_mode_clipping};
-    render_state_begin(document, state, &newstate, otfsvg_blend_mode_dst_in);
+    render_state_begin(context, state, &newstate, otfsvg_blend_mode_dst_in);
 
     if(units == units_type_object_bounding_box) {
         otfsvg_matrix_translate(&newstate.matrix, state->bbox.x, state->bbox.y);
         otfsvg_matrix_scale(&newstate.matrix, state->bbox.w, state->bbox.h);
     }
 
-    render_children(document, &newstate, element);
-    render_state_end(document, state, &newstate, otfsvg_blend_mode_dst_in);
+    render_children(context, &newstate, element);
+    render_state_end(context, state, &newstate, otfsvg_blend_mode_dst_in);
+}
+
+/*
+ * When rendering against a clip rectangle, the bounds of an element are computed by a bounding pass over its subtree
+ * from the state of its parent, so they take the same transforms, clip paths and strokes into account. An element
+ * outside the rectangle is skipped, and the clip is dropped below an element that lies entirely inside it, so that
+ * only the subtrees crossing its edges are measured level after level.
+ */
+static bool render_clip_begin(otfsvg_render_context_t* context, render_state_t* state, const element_t* element, const otfsvg_rect_t** clip)
+{
+    *clip = context->clip;
+    if(context->clip == NULL || state->mode != render_mode_display)
+        return true;
+    render_state_t newstate = *state;
+    newstate.mode = render_mode_bounding;
+    otfsvg_rect_init(&newstate.bbox, FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX);
+    render_element(context, &newstate, element);
+    if(newstate.bbox.w < 0 || newstate.bbox.h < 0)
+        return false;
+
+    otfsvg_rect_t rect;
+    const otfsvg_rect_t* r = context->clip;
+    otfsvg_matrix_map_rect(&state->matrix, &newstate.bbox, &rect);
+    if(rect.x > r->x + r->w || rect.y > r->y + r->h || rect.x + rect.w < r->x || rect.y + rect.h < r->y)
+        return false;
+    if(rect.x >= r->x && rect.y >= r->y && rect.x + rect.w <= r->x + r->w && rect.y + rect.h <= r->y + r->h)
+        context->clip = NULL;
+    return true;
 }
 
-static void render_image(otfsvg_document_t* document, render_state_t* state, element_t* element)
+static void render_image(otfsvg_render_context_t* context, render_state_t* state, const element_t* element)
 {
     if(is_display_none(element))
         return;
@@ -2739,32 +4367,33 @@ static void render_image(otfsvg_document_t* document, render_state_t* state, ele
     length_t w = {100, length_type_percent};
     length_t h = {100, length_type_percent};
 
-    parse_length(element, ID_WIDTH, &w, false, false);
-    parse_length(element, ID_HEIGHT, &h, false, false);
+    get_length(element, ID_WIDTH, &w);
+    get_length(element, ID_HEIGHT, &h);
     if(is_length_zero(w) || is_length_zero(h))
         return;
 
     length_t x = {0, length_type_px};
     length_t y = {0, length_type_px};
 
-    parse_length(element, ID_X, &x, true, false);
-    parse_length(element, ID_Y, &y, true, false);
+    get_length(element, ID_X, &x);
+    get_length(element, ID_Y, &y);
 
-    float _x = resolve_length(document, &x, 'x');
-    float _y = resolve_length(document, &y, 'y');
-    float _w = resolve_length(document, &w, 'x');
-    float _h = resolve_length(document, &h, 'y');
+    float _x = resolve_length(context, &x, 'x');
+    float _y = resolve_length(context, &y, 'y');
+    float _w = resolve_length(context, &w, 'x');
+    float _h = resolve_length(context, &h, 'y');
 
-    const string_t* href = find_property(element, ID_XLINK_HREF, false);
-    if(href == NULL)
+    string_t href;
+    if(!find_property(context->document, element, ID_XLINK_HREF, &href))
         return;
 
     otfsvg_image_t image;
-    if(!document_decode_image(document, href, &image))
+    if(!document_decode_image(context, &href, &image))
         return;
 
     render_state_t newstate = {element, state->mode};
-    render_state_begin(document, state, &newstate, otfsvg_blend_mode_src_over);
+    if(!render_state_begin(context, state, &newstate, otfsvg_blend_mode_src_over))
+        return;
 
     newstate.bbox.x = _x;
     newstate.bbox.y = _y;
@@ -2772,7 +4401,7 @@ static void render_image(otfsvg_document_t* document, render_state_t* state, ele
     newstate.bbox.h = _h;
 
     position_t position = {position_align_x_mid_y_mid, position_scale_meet};
-    parse_position(element, ID_PRESERVE_ASPECT_RATIO, &position);
+    get_position(element, ID_PRESERVE_ASPECT_RATIO, &position);
 
     otfsvg_rect_t rect;
     otfsvg_rect_t clip = {_x, _y, _w, _h};
@@ -2781,13 +4410,13 @@ static void render_image(otfsvg_document_t* document, render_state_t* state, ele
     otfsvg_matrix_translate(&newstate.matrix, rect.x, rect.y);
     otfsvg_matrix_scale(&newstate.matrix, rect.w / image.width, rect.h / image.height);
 
-    document_draw_image(document, &newstate, &image, &clip);
-    render_state_end(document, state, &newstate, otfsvg_blend_mode_src_over);
+    document_draw_image(context, &newstate, &image, &clip);
+    render_state_end(context, state, &newstate, otfsvg_blend_mode_src_over);
 }
 
-static void render_svg(otfsvg_document_t* document, render_state_t* state, element_t* element)
+static void render_svg(otfsvg_render_context_t* context, render_state_t* state, const element_t* element)
 {
-    if(document->height == 0.f || document->width == 0.f)
+    if(context->document->height == 0.f || context->document->width == 0.f)
         return;
     if(is_display_none(element))
         return;
@@ -2795,700 +4424,4103 @@ static void render_svg(otfsvg_document_t* document, render_state_t* state, eleme
     length_t w = {100, length_type_percent};
     length_t h = {100, length_type_percent};
 
-    parse_length(element, ID_WIDTH, &w, false, false);
-    parse_length(element, ID_HEIGHT, &h, false, false);
+    get_length(element, ID_WIDTH, &w);
+    get_length(element, ID_HEIGHT, &h);
     if(is_length_zero(w) || is_length_zero(h))
         return;
 
     length_t x = {0, length_type_px};
     length_t y = {0, length_type_px};
 
-    parse_length(element, ID_X, &x, true, false);
-    parse_length(element, ID_Y, &y, true, false);
+    get_length(element, ID_X, &x);
+    get_length(element, ID_Y, &y);
 
-    float _x = resolve_length(document, &x, 'x');
-    float _y = resolve_length(document, &y, 'y');
-    float _w = resolve_length(document, &w, 'x');
-    float _h = resolve_length(document, &h, 'y');
+    float _x = resolve_length(context, &x, 'x');
+    float _y = resolve_length(context, &y, 'y');
+    float _w = resolve_length(context, &w, 'x');
+    float _h = resolve_length(context, &h, 'y');
 
     render_state_t newstate = {element, state->mode};
-    render_state_begin(document, state, &newstate, otfsvg_blend_mode_src_over);
+    if(!render_state_begin(context, state, &newstate, otfsvg_blend_mode_src_over))
+        return;
     otfsvg_matrix_translate(&newstate.matrix, _x, _y);
 
     otfsvg_rect_t viewbox;
-    if(parse_view_box(element, ID_VIEWBOX, &viewbox)) {
+    if(get_view_box(element, ID_VIEWBOX, &viewbox)) {
         position_t position = {position_align_x_mid_y_mid, position_scale_meet};
-        parse_position(element, ID_PRESERVE_ASPECT_RATIO, &position);
+        get_position(element, ID_PRESERVE_ASPECT_RATIO, &position);
 
         otfsvg_matrix_t matrix;
         position_get_matrix(&position, &matrix, &viewbox, _w, _h);
         otfsvg_matrix_multiply(&newstate.matrix, &matrix, &newstate.matrix);
     }
 
-    render_children(document, &newstate, element);
-    render_state_end(document, state, &newstate, otfsvg_blend_mode_src_over);
+    render_children(context, &newstate, element);
+    render_state_end(context, state, &newstate, otfsvg_blend_mode_src_over);
 }
 
-static void render_use(otfsvg_document_t* document, render_state_t* state, element_t* element)
+static void render_use(otfsvg_render_context_t* context, render_state_t* state, const element_t* element)
 {
     if(is_display_none(element))
         return;
 
-    element_t* ref = resolve_iri(document, element, ID_XLINK_HREF);
+    const element_t* ref = resolve_iri(context, element, ID_XLINK_HREF);
     if(ref == NULL)
         return;
+    for(const parent_override_t* override = context->overrides; override; override = override->next) {
+        if(override->parent == element) {
+            return;
+        }
+    }
+
+    const otfsvg_rect_t* clip;
+    if(!render_clip_begin(context, state, element, &clip))
+        return;
 
     length_t x = {0, length_type_px};
     length_t y = {0, length_type_px};
 
-    parse_length(element, ID_X, &x, true, false);
-    parse_length(element, ID_Y, &y, true, false);
+    get_length(element, ID_X, &x);
+    get_length(element, ID_Y, &y);
 
     render_state_t newstate = {element, state->mode};
-    render_state_begin(document, state, &newstate, otfsvg_blend_mode_src_over);
+    if(!render_state_begin(context, state, &newstate, otfsvg_blend_mode_src_over)) {
+        context->clip = clip;
+        return;
+    }
 
-    float _x = resolve_length(document, &x, 'x');
-    float _y = resolve_length(document, &y, 'y');
+    float _x = resolve_length(context, &x, 'x');
+    float _y = resolve_length(context, &y, 'y');
 
     otfsvg_matrix_translate(&newstate.matrix, _x, _y);
 
-    element_t* parent = ref->parent;
-    ref->parent = element;
-    render_element(document, &newstate, ref);
-    ref->parent = parent;
+    parent_override_t override = {ref, element, context->overrides};
+    context->overrides = &override;
+    render_element(context, &newstate, ref);
+    context->overrides = override.next;
 
-    render_state_end(document, state, &newstate, otfsvg_blend_mode_src_over);
+    render_state_end(context, state, &newstate, otfsvg_blend_mode_src_over);
+    context->clip = clip;
 }
 
-static void render_g(otfsvg_document_t* document, render_state_t* state, element_t* element)
+static void render_g(otfsvg_render_context_t* context, render_state_t* state, const element_t* element)
 {
     if(is_display_none(element))
         return;
 
+    const otfsvg_rect_t* clip;
+    if(!render_clip_begin(context, state, element, &clip))
+        return;
+
     render_state_t newstate = {element, state->mode};
-    render_state_begin(document, state, &newstate, otfsvg_blend_mode_src_over);
-    render_children(document, &newstate, element);
-    render_state_end(document, state, &newstate, otfsvg_blend_mode_src_over);
+    if(!render_state_begin(context, state, &newstate, otfsvg_blend_mode_src_over)) {
+        context->clip = clip;
+        return;
+    }
+
+    render_children(context, &newstate, element);
+    render_state_end(context, state, &newstate, otfsvg_blend_mode_src_over);
+    context->clip = clip;
 }
 
-static void render_line(otfsvg_document_t* document, render_state_t* state, element_t* element)
+/*
+ * The geometry of a shape element depends only on its own attributes and on the document size, so it is built once,
+ * when the element is loaded, into the document heap together with its bounding box. Renders pass the stored path to
+ * the canvas as is; an element whose shape is NULL has no geometry and draws nothing.
+ */
+static bool build_line(const otfsvg_document_t* document, const element_t* element, otfsvg_path_t* path, otfsvg_rect_t* bbox)
 {
-    if(is_display_none(element))
-        return;
-
     length_t x1 = {0, length_type_px};
     length_t y1 = {0, length_type_px};
     length_t x2 = {0, length_type_px};
     length_t y2 = {0, length_type_px};
 
-    parse_length(element, ID_X1, &x1, true, false);
-    parse_length(element, ID_Y1, &y1, true, false);
-    parse_length(element, ID_X2, &x2, true, false);
-    parse_length(element, ID_Y2, &y2, true, false);
-
-    float _x1 = resolve_length(document, &x1, 'x');
-    float _y1 = resolve_length(document, &y1, 'y');
-    float _x2 = resolve_length(document, &x2, 'x');
-    float _y2 = resolve_length(document, &y2, 'y');
+    get_length(element, ID_X1, &x1);
+    get_length(element, ID_Y1, &y1);
+    get_length(element, ID_X2, &x2);
+    get_length(element, ID_Y2, &y2);
 
-    render_state_t newstate = {element, state->mode};
-    render_state_begin(document, state, &newstate, otfsvg_blend_mode_src_over);
+    float _x1 = document_length(document, &x1, 'x');
+    float _y1 = document_length(document, &y1, 'y');
+    float _x2 = document_length(document, &x2, 'x');
+    float _y2 = document_length(document, &y2, 'y');
 
-    newstate.bbox.x = otfsvg_min(_x1, _x2);
-    newstate.bbox.y = otfsvg_min(_y1, _y2);
-    newstate.bbox.w = fabsf(_x2 - _x1);
-    newstate.bbox.h = fabsf(_y2 - _y1);
+    bbox->x = otfsvg_min(_x1, _x2);
+    bbox->y = otfsvg_min(_y1, _y2);
+    bbox->w = fabsf(_x2 - _x1);
+    bbox->h = fabsf(_y2 - _y1);
 
-    otfsvg_path_t* path = &document->path;
-    otfsvg_path_clear(path);
     otfsvg_path_move_to(path, _x1, _y1);
     otfsvg_path_line_to(path, _x2, _y2);
-
-    document_draw(document, &newstate);
-    render_state_end(document, state, &newstate, otfsvg_blend_mode_src_over);
-}
-
-static void render_polyline(otfsvg_document_t* document, render_state_t* state, element_t* element)
-{
-    if(is_display_none(element))
-        return;
-
-    otfsvg_path_t* path = &document->path;
-    otfsvg_path_clear(path);
-    parse_points(element, ID_POINTS, path);
-    if(path->commands.size == 0)
-        return;
-
-    render_state_t newstate = {element, state->mode};
-    render_state_begin(document, state, &newstate, otfsvg_blend_mode_src_over);
-
-    otfsvg_path_bounding_box(path, &newstate.bbox);
-
-    document_draw(document, &newstate);
-    render_state_end(document, state, &newstate, otfsvg_blend_mode_src_over);
+    return true;
 }
 
-static void render_polygon(otfsvg_document_t* document, render_state_t* state, element_t* element)
+static bool build_polyline(const otfsvg_document_t* document, const element_t* element, otfsvg_path_t* path, otfsvg_rect_t* bbox)
 {
-    if(is_display_none(element))
-        return;
-
-    otfsvg_path_t* path = &document->path;
-    otfsvg_path_clear(path);
-    parse_points(element, ID_POINTS, path);
-    otfsvg_path_close(path);
+    string_t value;
+    if(!find_property(document, element, ID_POINTS, &value))
+        return false;
+    parse_points(&value, path);
+    if(element->id == TAG_POLYGON)
+        otfsvg_path_close(path);
     if(path->commands.size == 0)
-        return;
-
-    render_state_t newstate = {element, state->mode};
-    render_state_begin(document, state, &newstate, otfsvg_blend_mode_src_over);
-
-    otfsvg_path_bounding_box(path, &newstate.bbox);
+        return false;
 
-    document_draw(document, &newstate);
-    render_state_end(document, state, &newstate, otfsvg_blend_mode_src_over);
+    otfsvg_path_bounding_box(path, bbox);
+    return true;
 }
 
-static void render_path(otfsvg_document_t* document, render_state_t* state, element_t* element)
+static bool build_path(const otfsvg_document_t* document, const element_t* element, otfsvg_path_t* path, otfsvg_rect_t* bbox)
 {
-    if(is_display_none(element))
-        return;
-
-    otfsvg_path_t* path = &document->path;
-    otfsvg_path_clear(path);
-    parse_path(element, ID_D, path);
+    string_t value;
+    if(!find_property(document, element, ID_D, &value))
+        return false;
+    parse_path(&value, path);
     if(path->commands.size == 0)
-        return;
-
-    render_state_t newstate = {element, state->mode};
-    render_state_begin(document, state, &newstate, otfsvg_blend_mode_src_over);
-
-    otfsvg_path_bounding_box(path, &newstate.bbox);
+        return false;
 
-    document_draw(document, &newstate);
-    render_state_end(document, state, &newstate, otfsvg_blend_mode_src_over);
+    otfsvg_path_bounding_box(path, bbox);
+    return true;
 }
 
-static void render_ellipse(otfsvg_document_t* document, render_state_t* state, element_t* element)
+static bool build_ellipse(const otfsvg_document_t* document, const element_t* element, otfsvg_path_t* path, otfsvg_rect_t* bbox)
 {
-    if(is_display_none(element))
-        return;
-
     length_t rx = {0, length_type_px};
     length_t ry = {0, length_type_px};
 
-    parse_length(element, ID_RX, &rx, false, false);
-    parse_length(element, ID_RY, &ry, false, false);
+    get_length(element, ID_RX, &rx);
+    get_length(element, ID_RY, &ry);
 
     if(is_length_zero(rx) || is_length_zero(ry))
-        return;
+        return false;
 
     length_t cx = {0, length_type_px};
     length_t cy = {0, length_type_px};
 
-    parse_length(element, ID_CX, &cx, true, false);
-    parse_length(element, ID_CY, &cy, true, false);
-
-    float _cx = resolve_length(document, &cx, 'x');
-    float _cy = resolve_length(document, &cy, 'y');
-    float _rx = resolve_length(document, &rx, 'x');
-    float _ry = resolve_length(document, &ry, 'y');
+    get_length(element, ID_CX, &cx);
+    get_length(element, ID_CY, &cy);
 
-    render_state_t newstate = {element, state->mode};
-    render_state_begin(document, state, &newstate, otfsvg_blend_mode_src_over);
+    float _cx = document_length(document, &cx, 'x');
+    float _cy = document_length(document, &cy, 'y');
+    float _rx = document_length(document, &rx, 'x');
+    float _ry = document_length(document, &ry, 'y');
 
-    newstate.bbox.x = _cx - _rx;
-    newstate.bbox.y = _cy - _ry;
-    newstate.bbox.w = _rx + _rx;
-    newstate.bbox.h = _ry + _ry;
+    bbox->x = _cx - _rx;
+    bbox->y = _cy - _ry;
+    bbox->w = _rx + _rx;
+    bbox->h = _ry + _ry;
 
-    otfsvg_path_t* path = &document->path;
-    otfsvg_path_clear(path);
     otfsvg_path_add_ellipse(path, _cx, _cy, _rx, _ry);
-    document_draw(document, &newstate);
-
-    render_state_end(document, state, &newstate, otfsvg_blend_mode_src_over);
+    return true;
 }
 
-static void render_circle(otfsvg_document_t* document, render_state_t* state, element_t* element)
+static bool build_circle(const otfsvg_document_t* document, const element_t* element, otfsvg_path_t* path, otfsvg_rect_t* bbox)
 {
-    if(is_display_none(element))
-        return;
-
     length_t r = {0, length_type_px};
-    parse_length(element, ID_R, &r, false, false);
+    get_length(element, ID_R, &r);
     if(is_length_zero(r))
-        return;
+        return false;
 
     length_t cx = {0, length_type_px};
     length_t cy = {0, length_type_px};
 
-    parse_length(element, ID_CX, &cx, true, false);
-    parse_length(element, ID_CY, &cy, true, false);
+    get_length(element, ID_CX, &cx);
+    get_length(element, ID_CY, &cy);
 
-    float _cx = resolve_length(document, &cx, 'x');
-    float _cy = resolve_length(document, &cy, 'y');
-    float _r = resolve_length(document, &r, 'o');
+    float _cx = document_length(document, &cx, 'x');
+    float _cy = document_length(document, &cy, 'y');
+    float _r = document_length(document, &r, 'o');
 
-    render_state_t newstate = {element, state->mode};
-    render_state_begin(document, state, &newstate, otfsvg_blend_mode_src_over);
-
-    newstate.bbox.x = _cx - _r;
-    newstate.bbox.y = _cy - _r;
-    newstate.bbox.w = _r + _r;
-    newstate.bbox.h = _r + _r;
+    bbox->x = _cx - _r;
+    bbox->y = _cy - _r;
+    bbox->w = _r + _r;
+    bbox->h = _r + _r;
 
-    otfsvg_path_t* path = &document->path;
-    otfsvg_path_clear(path);
     otfsvg_path_add_ellipse(path, _cx, _cy, _r, _r);
-    document_draw(document, &newstate);
-
-    render_state_end(document, state, &newstate, otfsvg_blend_mode_src_over);
+    return true;
 }
 
-static void render_rect(otfsvg_document_t* document, render_state_t* state, element_t* element)
+static bool build_rect(const otfsvg_document_t* document, const element_t* element, otfsvg_path_t* path, otfsvg_rect_t* bbox)
 {
-    if(is_display_none(element))
-        return;
-
     length_t w = {0, length_type_px};
     length_t h = {0, length_type_px};
 
-    parse_length(element, ID_WIDTH, &w, false, false);
-    parse_length(element, ID_HEIGHT, &h, false, false);
+    get_length(element, ID_WIDTH, &w);
+    get_length(element, ID_HEIGHT, &h);
 
     if(is_length_zero(w) || is_length_zero(h))
-        return;
+        return false;
 
     length_t x = {0, length_type_px};
     length_t y = {0, length_type_px};
 
-    parse_length(element, ID_X, &x, true, false);
-    parse_length(element, ID_Y, &y, true, false);
+    get_length(element, ID_X, &x);
+    get_length(element, ID_Y, &y);
 
-    float _x = resolve_length(document, &x, 'x');
-    float _y = resolve_length(document, &y, 'y');
-    float _w = resolve_length(document, &w, 'x');
-    float _h = resolve_length(document, &h, 'y');
+    float _x = document_length(document, &x, 'x');
+    float _y = document_length(document, &y, 'y');
+    float _w = document_length(document, &w, 'x');
+    float _h = document_length(document, &h, 'y');
 
     length_t rx = {0, length_type_unknown};
     length_t ry = {0, length_type_unknown};
 
-    parse_length(element, ID_RX, &rx, false, false);
-    parse_length(element, ID_RY, &ry, false, false);
+    get_length(element, ID_RX, &rx);
+    get_length(element, ID_RY, &ry);
 
-    float _rx = resolve_length(document, &rx, 'x');
-    float _ry = resolve_length(document, &ry, 'y');
+    float _rx = document_length(document, &rx, 'x');
+    float _ry = document_length(document, &ry, 'y');
 
     if(!is_length_valid(rx)) _rx = _ry;
     if(!is_length_valid(ry)) _ry = _rx;
 
-    render_state_t newstate = {element, state->mode};
-    render_state_begin(document, state, &newstate, otfsvg_blend_mode_src_over);
+    bbox->x = _x;
+    bbox->y = _y;
+    bbox->w = _w;
+    bbox->h = _h;
 
-    newstate.bbox.x = _x;
-    newstate.bbox.y = _y;
-    newstate.bbox.w = _w;
-    newstate.bbox.h = _h;
+    otfsvg_path_add_round_rect(path, _x, _y, _w, _h, _rx, _ry);
+    return true;
+}
 
+static const shape_t* create_shape(otfsvg_document_t* document, const element_t* element)
+{
     otfsvg_path_t* path = &document->path;
+    otfsvg_rect_t bbox;
+    bool success = false;
     otfsvg_path_clear(path);
-    otfsvg_path_add_round_rect(path, _x, _y, _w, _h, _rx, _ry);
-    document_draw(document, &newstate);
+    switch(element->id) {
+    case TAG_LINE:
+        success = build_line(document, element, path, &bbox);
+        break;
+    case TAG_POLYLINE:
+    case TAG_POLYGON:
+        success = build_polyline(document, element, path, &bbox);
+        break;
+    case TAG_PATH:
+        success = build_path(document, element, path, &bbox);
+        break;
+    case TAG_ELLIPSE:
+        success = build_ellipse(document, element, path, &bbox);
+        break;
+    case TAG_CIRCLE:
+        success = build_circle(document, element, path, &bbox);
+        break;
+    case TAG_RECT:
+        success = build_rect(document, element, path, &bbox);
+        break;
+    }
+
+    if(!success)
+        return NULL;
+    shape_t shape = {bbox, path->commands.size, path->points.size};
+    shape_t* result = heap_alloc(document->heap, shape_size(&shape));
+    otfsvg_path_t data;
+    *result = shape;
+    shape_path(result, &data);
+    memcpy(data.points.data, path->points.data, path->points.size * sizeof(otfsvg_point_t));
+    memcpy(data.commands.data, path->commands.data, path->commands.size * sizeof(otfsvg_path_command_t));
+    return result;
+}
+
+static void build_elements(otfsvg_document_t* document, element_t* root)
+{
+    element_t* end = root + root->end;
+    for(element_t* element = root; element < end; element++) {
+        const style_t* style = create_style(document, element);
+        const shape_t* shape = create_shape(document, element);
+        element->style = (intptr_t)(style) - (intptr_t)(element);
+        element->shape = shape ? (intptr_t)(shape) - (intptr_t)(element) : 0;
+    }
+}
+
+static void render_shape(otfsvg_render_context_t* context, render_state_t* state, const element_t* element)
+{
+    const shape_t* shape = element_shape(element);
+    if(shape == NULL || is_display_none(element))
+        return;
+
+    const otfsvg_rect_t* clip;
+    if(!render_clip_begin(context, state, element, &clip))
+        return;
+
+    render_state_t newstate = {element, state->mode};
+    if(!render_state_begin(context, state, &newstate, otfsvg_blend_mode_src_over)) {
+        context->clip = clip;
+        return;
+    }
 
-    render_state_end(document, state, &newstate, otfsvg_blend_mode_src_over);
+    newstate.bbox = shape->bbox;
+    document_draw(context, &newstate);
+    render_state_end(context, state, &newstate, otfsvg_blend_mode_src_over);
+    context->clip = clip;
 }
 
-static void render_element(otfsvg_document_t* document, render_state_t* state, element_t* element)
+static void render_element(otfsvg_render_context_t* context, render_state_t* state, const element_t* element)
 {
     switch(element->id) {
     case TAG_USE:
-        render_use(document, state, element);
+        render_use(context, state, element);
         break;
     case TAG_G:
-        render_g(document, state, element);
+        render_g(context, state, element);
         break;
     case TAG_LINE:
-        render_line(document, state, element);
-        break;
     case TAG_POLYLINE:
-        render_polyline(document, state, element);
-        break;
     case TAG_POLYGON:
-        render_polygon(document, state, element);
-        break;
     case TAG_PATH:
-        render_path(document, state, element);
-        break;
     case TAG_ELLIPSE:
-        render_ellipse(document, state, element);
-        break;
     case TAG_CIRCLE:
-        render_circle(document, state, element);
-        break;
     case TAG_RECT:
-        render_rect(document, state, element);
+        render_shape(context, state, element);
         break;
     }
 }
 
-static void render_children(otfsvg_document_t* document, render_state_t* state, element_t* element)
+static inline bool render_isolated(const otfsvg_render_context_t* context)
+{
+    const isolation_t* isolation = context->isolation;
+    return isolation && (isolation->overlap || isolation->count >= isolation->limit);
+}
+
+static void render_children(otfsvg_render_context_t* context, render_state_t* state, const element_t* element)
 {
-    element_t* child = element->firstchild;
-    while(child) {
-        render_element(document, state, child);
-        child = child->nextchild;
+    const element_t* end = element + element->end;
+    for(const element_t* child = element + 1; child < end && !render_isolated(context); child += child->end)
+        render_element(context, state, child);
+    const otfsvg_document_t* document = context->document;
+    if(element == document->root) {
+        const lazy_t* lazy = document->lazy;
+        for(int i = 0; i < lazy->slots.size && !render_isolated(context); i++) {
+            const element_t* child = lazy->slots.data[i].element;
+            if(child) {
+                render_element(context, state, child);
+            }
+        }
     }
 }
 
+static bool render_isolate(otfsvg_render_context_t* context, render_state_t* state, bool grouping, bool* empty)
+{
+    const element_t* element = state->element;
+    const shape_t* shape = element_shape(element);
+    isolation_t isolation;
+    isolation.count = 0;
+    isolation.limit = grouping ? ISOLATION_ITEMS + 1 : 1;
+    isolation.depth = 0;
+    isolation.margin = context->recorder ? 0.f : 1.f;
+    isolation.layer = false;
+    isolation.overlap = false;
+
+    const otfsvg_rect_t* clip = context->clip;
+    context->clip = NULL;
+    context->isolation = &isolation;
+    if(element->id == TAG_USE) {
+        const element_t* ref = resolve_iri(context, element, ID_XLINK_HREF);
+        if(ref) {
+            parent_override_t override = {ref, element, context->overrides};
+            context->overrides = &override;
+            render_element(context, state, ref);
+            context->overrides = override.next;
+        }
+    } else if(shape) {
+        render_state_t newstate = *state;
+        newstate.bbox = shape->bbox;
+        document_draw(context, &newstate);
+    } else if(element->id == TAG_G || element->id == TAG_SVG) {
+        render_children(context, state, element);
+    } else {
+        isolation.count = 1;
+        isolation.overlap = true;
+    }
+
+    context->isolation = NULL;
+    context->clip = clip;
+
+    /* the viewport transform of an svg element is set after its layer, so the bounds collected here are not final */
+    if(element->id == TAG_SVG)
+        isolation.overlap = true;
+    *empty = isolation.count == 0;
+    return isolation.overlap;
+}
+
+otfsvg_render_context_t* otfsvg_render_context_create(void)
+{
+    otfsvg_render_context_t* context = malloc(sizeof(otfsvg_render_context_t));
+    otfsvg_array_init(context->paint.gradient.stops);
+    context->paint.gradient.type = otfsvg_gradient_type_linear;
+    context->paint.gradient.spread = otfsvg_gradient_spread_pad;
+    otfsvg_array_init(context->sources);
+    otfsvg_array_init(context->strokedata.dasharray);
+    context->document = NULL;
+    context->canvas = NULL;
+    context->canvas_data = NULL;
+    context->palette_func = NULL;
+    context->palette_data = NULL;
+    context->current_color = otfsvg_black_color;
+    context->overrides = NULL;
+    context->recorder = NULL;
+    context->clip = NULL;
+    context->isolation = NULL;
+    memset(&context->stats, 0, sizeof(context->stats));
+    return context;
+}
+
+void otfsvg_render_context_destroy(otfsvg_render_context_t* context)
+{
+    otfsvg_array_destroy(context->paint.gradient.stops);
+    otfsvg_array_destroy(context->sources);
+    otfsvg_array_destroy(context->strokedata.dasharray);
+    free(context);
+}
+
 otfsvg_document_t* otfsvg_document_create(void)
 {
     otfsvg_document_t* document = malloc(sizeof(otfsvg_document_t));
-    otfsvg_path_init(&document->path);
+    document->context = otfsvg_render_context_create();
     otfsvg_matrix_init_identity(&document->matrix);
-    otfsvg_array_init(document->paint.gradient.stops);
-    otfsvg_array_init(document->strokedata.dasharray);
+    otfsvg_path_init(&document->path);
+    otfsvg_array_init(document->glyphs);
+    otfsvg_array_init(document->elements);
+    otfsvg_array_init(document->properties);
+    otfsvg_array_init(document->values);
+    otfsvg_array_init(document->ids);
+    document->glyphbase = 0;
+    document->lazy = malloc(sizeof(lazy_t));
+    otfsvg_array_init(document->lazy->slots);
+    otfsvg_array_init(document->lazy->queue);
+    document->lazy->ids = hashmap_create();
+    document->lazy->current = -1;
+    document->lazy->complete = 0;
+#ifndef _WIN32
+    pthread_mutex_init(&document->lazy->mutex, NULL);
+#endif
+    document->inflated.data = NULL;
+    document->inflated.capacity = 0;
     document->idcache = hashmap_create();
     document->heap = heap_create();
     document->root = NULL;
+    document->source = NULL;
+    document->sourcelength = 0;
+    document->image = NULL;
+    document->mapping = NULL;
+    document->mappinglength = 0;
     document->width = 0.f;
     document->height = 0.f;
     document->dpi = 96.f;
     return document;
 }
 
+static void document_unmap(otfsvg_document_t* document)
+{
+    if(document->mapping) {
+#ifdef _WIN32
+        free(document->mapping);
+#else
+        munmap(document->mapping, document->mappinglength);
+#endif
+    }
+
+    document->mapping = NULL;
+    document->mappinglength = 0;
+}
+
 void otfsvg_document_destory(otfsvg_document_t* document)
 {
+    document_unmap(document);
+    otfsvg_render_context_destroy(document->context);
     otfsvg_path_destroy(&document->path);
-    otfsvg_array_destroy(document->paint.gradient.stops);
-    otfsvg_array_destroy(document->strokedata.dasharray);
+    otfsvg_array_destroy(document->glyphs);
+    otfsvg_array_destroy(document->elements);
+    otfsvg_array_destroy(document->properties);
+    otfsvg_array_destroy(document->values);
+    otfsvg_array_destroy(document->ids);
+    otfsvg_array_destroy(document->lazy->slots);
+    otfsvg_array_destroy(document->lazy->queue);
+    hashmap_destroy(document->lazy->ids);
+#ifndef _WIN32
+    pthread_mutex_destroy(&document->lazy->mutex);
+#endif
+    free(document->lazy);
+    free(document->inflated.data);
     hashmap_destroy(document->idcache);
     heap_destroy(document->heap);
     free(document);
 }
 
+void otfsvg_document_set_retain_limit(otfsvg_document_t* document, size_t limit)
+{
+    document->heap->retainlimit = limit;
+    heap_trim(document->heap);
+}
+
 void otfsvg_document_clear(otfsvg_document_t* document)
 {
     otfsvg_matrix_init_identity(&document->matrix);
     hashmap_clear(document->idcache);
     heap_clear(document->heap);
+    otfsvg_array_clear(document->glyphs);
+    otfsvg_array_clear(document->lazy->slots);
+    hashmap_clear(document->lazy->ids);
+    document->lazy->current = -1;
+    document->lazy->complete = 0;
     document->width = 0.f;
     document->height = 0.f;
     document->root = NULL;
+    document->source = NULL;
+    document->sourcelength = 0;
+    document->image = NULL;
+    document_unmap(document);
 }
 
-static bool parse_attributes(const char** begin, const char* end, otfsvg_document_t* document, element_t* element)
-{
-    const char* it = *begin;
-    while(it < end && IS_STARTNAMECHAR(*it)) {
-        const char* begin = it;
-        ++it;
-        while(it < end && IS_NAMECHAR(*it))
-            ++it;
+#define INFLATE_FAST_BITS 9
+#define INFLATE_CHUNK_SIZE 4096
+#define INFLATE_INITIAL_SIZE (1024 * 1024)
 
-        int id = propertyid(begin, it - begin);
-        skip_ws(&it, end);
-        if(it >= end || *it != '=')
-            return false;
+typedef struct {
+    uint16_t fast[1 << INFLATE_FAST_BITS];
+    uint16_t count[16];
+    uint16_t symbol[288];
+} huffman_t;
 
-        ++it;
-        skip_ws(&it, end);
-        if(it >= end || (*it != '"' && *it != '\''))
-            return false;
+typedef struct {
+    const uint8_t* it;
+    const uint8_t* end;
+    uint32_t bitbuf;
+    int bitcount;
+    int padding;
+    inflate_buffer_t* buffer;
+    uint8_t* output;
+    size_t size;
+    size_t capacity;
+    size_t limit;
+} inflate_t;
 
-        const char quote = *it;
-        ++it;
-        skip_ws(&it, end);
-        begin = it;
-        while(it < end && *it != quote)
-            ++it;
-        if(it >= end || *it != quote)
-            return false;
-        if(id && element) {
-            if(id == ID_ID) {
-                hashmap_put(document->idcache, document->heap, begin, it - begin, element);
-            } else {
-                property_t* property = heap_alloc(document->heap, sizeof(property_t));
-                property->id = id;
-                property->value.data = begin;
-                property->value.length = it - begin;
-                property->next = element->property;
-                element->property = property;
-            }
+static inline void inflate_refill(inflate_t* inflate)
+{
+    while(inflate->bitcount <= 24) {
+        uint32_t byte = 0;
+        if(inflate->it < inflate->end) {
+            byte = *inflate->it++;
+        } else {
+            inflate->padding += 1;
         }
 
-        ++it;
-        skip_ws(&it, end);
+        inflate->bitbuf |= byte << inflate->bitcount;
+        inflate->bitcount += 8;
     }
+}
 
-    *begin = it;
-    return true;
+static inline uint32_t inflate_bits(inflate_t* inflate, int count)
+{
+    if(inflate->bitcount < count)
+        inflate_refill(inflate);
+    uint32_t value = inflate->bitbuf & ((1u << count) - 1);
+    inflate->bitbuf >>= count;
+    inflate->bitcount -= count;
+    return value;
 }
 
-bool otfsvg_document_load(otfsvg_document_t* document, const char* data, size_t length, float width, float height, float dpi)
+static inline bool inflate_overrun(const inflate_t* inflate)
 {
-    otfsvg_document_clear(document);
-    const char* it = data;
-    const char* end = it + length;
+    return inflate->padding * 8 > inflate->bitcount;
+}
 
-    element_t* current = NULL;
-    int ignoring = 0;
-    while(it < end) {
-        while(it < end && *it != '<')
-            ++it;
+static bool inflate_grow(inflate_t* inflate, size_t count)
+{
+    if(count > inflate->limit - inflate->size)
+        return false;
+    size_t capacity = inflate->capacity ? inflate->capacity : INFLATE_CHUNK_SIZE;
+    while(capacity - inflate->size < count) {
+        if(capacity > inflate->limit / 2)
+            capacity = inflate->limit;
+        else
+            capacity *= 2;
+    }
 
-        if(it >= end || *it != '<')
-            break;
+    if(capacity > inflate->limit)
+        capacity = inflate->limit;
+    char* data = realloc(inflate->buffer->data, capacity);
+    if(data == NULL)
+        return false;
+    inflate->buffer->data = data;
+    inflate->buffer->capacity = capacity;
+    inflate->output = (uint8_t*)(data);
+    inflate->capacity = capacity;
+    return true;
+}
 
-        ++it;
-        if(it < end && *it == '/') {
-            ++it;
-            if(it >= end || !IS_STARTNAMECHAR(*it))
-                break;
+static inline bool inflate_reserve(inflate_t* inflate, size_t count)
+{
+    if(count <= inflate->capacity - inflate->size)
+        return true;
+    return inflate_grow(inflate, count);
+}
 
-            ++it;
-            while(it < end && IS_NAMECHAR(*it))
-                ++it;
+static bool huffman_build(huffman_t* huffman, const uint8_t* lengths, int count)
+{
+    memset(huffman->count, 0, sizeof(huffman->count));
+    memset(huffman->fast, 0, sizeof(huffman->fast));
+    for(int i = 0; i < count; i++)
+        huffman->count[lengths[i]] += 1;
+    huffman->count[0] = 0;
 
-            skip_ws(&it, end);
-            if(it >= end || *it != '>')
-                break;
+    int left = 1;
+    uint16_t offsets[16];
+    offsets[1] = 0;
+    for(int length = 1; length < 16; length++) {
+        left = (left << 1) - huffman->count[length];
+        if(left < 0)
+            return false;
+        if(length < 15) {
+            offsets[length + 1] = offsets[length] + huffman->count[length];
+        }
+    }
 
-            if(ignoring > 0)
-                --ignoring;
-            else if(current && current->parent)
-                current = current->parent;
+    for(int i = 0; i < count; i++) {
+        if(lengths[i] > 0) {
+            huffman->symbol[offsets[lengths[i]]++] = i;
+        }
+    }
 
-            ++it;
-            continue;
+    int code = 0;
+    int index = 0;
+    for(int length = 1; length <= INFLATE_FAST_BITS; length++) {
+        for(int i = 0; i < huffman->count[length]; i++) {
+            int reversed = 0;
+            for(int bit = 0; bit < length; bit++)
+                reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+            uint16_t entry = (uint16_t)(huffman->symbol[index] << 4 | length);
+            for(int slot = reversed; slot < (1 << INFLATE_FAST_BITS); slot += 1 << length)
+                huffman->fast[slot] = entry;
+            ++code;
+            ++index;
         }
 
-        if(it < end && *it == '?') {
-            ++it;
-            if(!skip_string(&it, end, "xml"))
-                break;
+        code <<= 1;
+    }
 
-            skip_ws(&it, end);
-            if(!parse_attributes(&it, end, document, NULL))
-                break;
+    return true;
+}
 
-            if(!skip_string(&it, end, "?>"))
-                break;
+static int huffman_decode(inflate_t* inflate, const huffman_t* huffman)
+{
+    if(inflate->bitcount < 15)
+        inflate_refill(inflate);
+    uint16_t entry = huffman->fast[inflate->bitbuf & ((1 << INFLATE_FAST_BITS) - 1)];
+    if(entry) {
+        int length = entry & 15;
+        inflate->bitbuf >>= length;
+        inflate->bitcount -= length;
+        return entry >> 4;
+    }
 
-            skip_ws(&it, end);
-            continue;
-        }
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for(int length = 1; length < 16; length++) {
+        code |= inflate->bitbuf & 1;
+        inflate->bitbuf >>= 1;
+        inflate->bitcount -= 1;
+        int count = huffman->count[length];
+        if(code - count < first)
+            return huffman->symbol[index + (code - first)];
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
 
-        if(it < end && *it == '!') {
+    return -1;
+}
+
+static const uint16_t inflate_length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+
+static const uint8_t inflate_length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const uint16_t inflate_distance_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+
+static const uint8_t inflate_distance_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static bool inflate_codes(inflate_t* inflate, const huffman_t* lengths, const huffman_t* distances)
+{
+    while(true) {
+        int symbol = huffman_decode(inflate, lengths);
+        if(symbol < 0 || inflate_overrun(inflate))
+            return false;
+        if(symbol < 256) {
+            if(!inflate_reserve(inflate, 1))
+                return false;
+            inflate->output[inflate->size++] = (uint8_t)(symbol);
+            continue;
+        }
+
+        if(symbol == 256)
+            return true;
+        symbol -= 257;
+        if(symbol >= 29)
+            return false;
+        size_t length = inflate_length_base[symbol] + inflate_bits(inflate, inflate_length_extra[symbol]);
+
+        symbol = huffman_decode(inflate, distances);
+        if(symbol < 0 || symbol >= 30)
+            return false;
+        size_t distance = inflate_distance_base[symbol] + inflate_bits(inflate, inflate_distance_extra[symbol]);
+        if(inflate_overrun(inflate) || distance > inflate->size || !inflate_reserve(inflate, length))
+            return false;
+
+        uint8_t* output = inflate->output + inflate->size;
+        const uint8_t* source = output - distance;
+        if(distance >= length) {
+            memcpy(output, source, length);
+        } else {
+            for(size_t i = 0; i < length; i++) {
+                output[i] = source[i];
+            }
+        }
+
+        inflate->size += length;
+    }
+}
+
+static bool inflate_stored(inflate_t* inflate)
+{
+    inflate->bitbuf >>= inflate->bitcount & 7;
+    inflate->bitcount &= ~7;
+
+    int buffered = inflate->bitcount / 8 - inflate->padding;
+    if(buffered < 0)
+        return false;
+    inflate->it -= buffered;
+    inflate->bitbuf = 0;
+    inflate->bitcount = 0;
+    inflate->padding = 0;
+    if(inflate->end - inflate->it < 4)
+        return false;
+
+    size_t length = inflate->it[0] | inflate->it[1] << 8;
+    size_t complement = inflate->it[2] | inflate->it[3] << 8;
+    inflate->it += 4;
+    if(length != (~complement & 0xFFFF) || length > (size_t)(inflate->end - inflate->it) || !inflate_reserve(inflate, length))
+        return false;
+
+    memcpy(inflate->output + inflate->size, inflate->it, length);
+    inflate->size += length;
+    inflate->it += length;
+    return true;
+}
+
+static bool inflate_fixed(inflate_t* inflate)
+{
+    uint8_t lengths[288 + 30];
+    int i = 0;
+    for(; i < 144; i++) lengths[i] = 8;
+    for(; i < 256; i++) lengths[i] = 9;
+    for(; i < 280; i++) lengths[i] = 7;
+    for(; i < 288; i++) lengths[i] = 8;
+    for(; i < 288 + 30; i++) lengths[i] = 5;
+
+    huffman_t codes[2];
+    huffman_build(&codes[0], lengths, 288);
+    huffman_build(&codes[1], lengths + 288, 30);
+    return inflate_codes(inflate, &codes[0], &codes[1]);
+}
+
+static bool inflate_dynamic(inflate_t* inflate)
+{
+    static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    int nlen = inflate_bits(inflate, 5) + 257;
+    int ndist = inflate_bits(inflate, 5) + 1;
+    int ncode = inflate_bits(inflate, 4) + 4;
+    if(nlen > 286 || ndist > 30)
+        return false;
+
+    uint8_t lengths[288 + 32];
+    memset(lengths, 0, 19);
+    for(int i = 0; i < ncode; i++)
+        lengths[order[i]] = inflate_bits(inflate, 3);
+
+    huffman_t codes[2];
+    if(!huffman_build(&codes[0], lengths, 19))
+        return false;
+
+    int index = 0;
+    while(index < nlen + ndist) {
+        int symbol = huffman_decode(inflate, &codes[0]);
+        if(symbol < 0 || inflate_overrun(inflate))
+            return false;
+        if(symbol < 16) {
+            lengths[index++] = symbol;
+            continue;
+        }
+
+        int repeat = 0;
+        uint8_t length = 0;
+        if(symbol == 16) {
+            if(index == 0)
+                return false;
+            length = lengths[index - 1];
+            repeat = 3 + inflate_bits(inflate, 2);
+        } else if(symbol == 17) {
+            repeat = 3 + inflate_bits(inflate, 3);
+        } else {
+            repeat = 11 + inflate_bits(inflate, 7);
+        }
+
+        if(index + repeat > nlen + ndist)
+            return false;
+        while(repeat--) {
+            lengths[index++] = length;
+        }
+    }
+
+    if(lengths[256] == 0)
+        return false;
+    if(!huffman_build(&codes[0], lengths, nlen) || !huffman_build(&codes[1], lengths + nlen, ndist))
+        return false;
+    return inflate_codes(inflate, &codes[0], &codes[1]);
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t length)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+
+    crc = ~crc;
+    for(size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        crc = (crc >> 4) ^ table[crc & 15];
+        crc = (crc >> 4) ^ table[crc & 15];
+    }
+
+    return ~crc;
+}
+
+static inline bool is_gzip(const char* data, size_t length)
+{
+    return length >= 18 && (uint8_t)(data[0]) == 0x1F && (uint8_t)(data[1]) == 0x8B;
+}
+
+static bool gzip_inflate(inflate_buffer_t* buffer, const char** data, size_t* length)
+{
+    const uint8_t* it = (const uint8_t*)(*data);
+    const uint8_t* end = it + *length;
+    int flags = it[3];
+    if(it[2] != 8 || (flags & 0xE0))
+        return false;
+    const uint8_t* trailer = end - 8;
+    it += 10;
+    if(flags & 4) {
+        if(trailer - it < 2)
+            return false;
+        size_t extra = it[0] | it[1] << 8;
+        if((size_t)(trailer - it - 2) < extra)
+            return false;
+        it += 2 + extra;
+    }
+
+    for(int flag = 8; flag <= 16; flag <<= 1) {
+        if(flags & flag) {
+            while(it < trailer && *it)
+                ++it;
+            if(it >= trailer)
+                return false;
             ++it;
-            if(skip_string(&it, end, "--")) {
-                const char* begin = string_find(it, end, "-->");
-                if(begin == NULL)
-                    break;
-                it = begin + 3;
-                skip_ws(&it, end);
-                continue;
+        }
+    }
+
+    if(flags & 2)
+        it += 2;
+    if(it > trailer)
+        return false;
+
+    uint32_t crc = trailer[0] | trailer[1] << 8 | trailer[2] << 16 | (uint32_t)(trailer[3]) << 24;
+    uint32_t size = trailer[4] | trailer[5] << 8 | trailer[6] << 16 | (uint32_t)(trailer[7]) << 24;
+    if(size / 1032 > (size_t)(trailer - it))
+        return false;
+
+    /*
+     * The size in the trailer comes from the file, so it only bounds the output: the buffer starts at no more than
+     * INFLATE_INITIAL_SIZE and grows with what is actually decoded.
+     */
+    inflate_t inflate;
+    inflate.it = it;
+    inflate.end = trailer;
+    inflate.bitbuf = 0;
+    inflate.bitcount = 0;
+    inflate.padding = 0;
+    inflate.buffer = buffer;
+    inflate.output = (uint8_t*)(buffer->data);
+    inflate.size = 0;
+    inflate.capacity = buffer->capacity < size ? buffer->capacity : size;
+    inflate.limit = size;
+    if(!inflate_reserve(&inflate, size < INFLATE_INITIAL_SIZE ? size : INFLATE_INITIAL_SIZE))
+        return false;
+
+    int last = 0;
+    do {
+        last = inflate_bits(&inflate, 1);
+        int type = inflate_bits(&inflate, 2);
+        bool success = false;
+        if(type == 0) {
+            success = inflate_stored(&inflate);
+        } else if(type == 1) {
+            success = inflate_fixed(&inflate);
+        } else if(type == 2) {
+            success = inflate_dynamic(&inflate);
+        }
+
+        if(!success || inflate_overrun(&inflate)) {
+            return false;
+        }
+    } while(!last);
+
+    if(inflate.size != size || crc32_update(0, inflate.output, inflate.size) != crc)
+        return false;
+    *data = buffer->data;
+    *length = inflate.size;
+    return true;
+}
+
+static bool parse_glyph_id(const char* data, size_t length, int* glyph)
+{
+    const char* it = data;
+    const char* end = it + length;
+    if(!skip_string(&it, end, "glyph") || it >= end)
+        return false;
+    if(*it == '0' && it + 1 < end)
+        return false;
+
+    int value = 0;
+    while(it < end && IS_NUM(*it)) {
+        value = value * 10 + (*it++ - '0');
+        if(value > 0xFFFF) {
+            return false;
+        }
+    }
+
+    *glyph = value;
+    return it == end;
+}
+
+static void add_glyph(otfsvg_document_t* document, int glyph, element_t* element, int slot)
+{
+    if(document->glyphs.size == 0)
+        document->glyphbase = glyph;
+    if(glyph < document->glyphbase) {
+        int count = document->glyphbase - glyph;
+        otfsvg_array_ensure(document->glyphs, count);
+        memmove(document->glyphs.data + count, document->glyphs.data, document->glyphs.size * sizeof(glyph_t));
+        memset(document->glyphs.data, 0, count * sizeof(glyph_t));
+        document->glyphs.size += count;
+        document->glyphbase = glyph;
+    }
+
+    int index = glyph - document->glyphbase;
+    if(index >= document->glyphs.size) {
+        int count = index + 1 - document->glyphs.size;
+        otfsvg_array_ensure(document->glyphs, count);
+        memset(document->glyphs.data + document->glyphs.size, 0, count * sizeof(glyph_t));
+        document->glyphs.size += count;
+    }
+
+    document->glyphs.data[index].element = element;
+    document->glyphs.data[index].slot = slot;
+}
+
+static void add_id(otfsvg_document_t* document, const char* data, size_t length, element_t* element)
+{
+    lazy_t* lazy = document->lazy;
+    int slot = 0;
+    if(lazy->current != -1) {
+        slot = lazy->current + 1;
+        if((intptr_t)(hashmap_get(lazy->ids, data, length)) != slot) {
+            return;
+        }
+    }
+
+    int glyph = 0;
+    hashmap_put(document->idcache, data, length, element);
+    if(parse_glyph_id(data, length, &glyph)) {
+        if(slot == 0) {
+            add_glyph(document, glyph, element, 0);
+        } else {
+            document->glyphs.data[glyph - document->glyphbase].element = element;
+        }
+    }
+}
+
+static void add_lazy_id(otfsvg_document_t* document, const char* data, size_t length, int slot)
+{
+    int glyph = 0;
+    hashmap_put(document->idcache, data, length, NULL);
+    hashmap_put(document->lazy->ids, data, length, (void*)(intptr_t)(slot + 1));
+    if(parse_glyph_id(data, length, &glyph)) {
+        add_glyph(document, glyph, NULL, slot + 1);
+    }
+}
+
+/*
+ * Ids are collected while tokenizing and registered once the subtree has been parsed, so the id maps are grown to
+ * their final size once instead of rehashing as they fill.
+ */
+static void add_ids(otfsvg_document_t* document, element_t* elements)
+{
+    int lazycount = 0;
+    for(int i = 0; i < document->ids.size; i++) {
+        if(document->ids.data[i].element == -1) {
+            lazycount += 1;
+        }
+    }
+
+    /*
+     * Every id of a lazily parsed slot was already registered by the pre-scan, which sized the maps. Other threads
+     * read the id cache without the lazy lock, so the lazy path must not resize it.
+     */
+    if(document->lazy->current == -1) {
+        hashmap_reserve(document->idcache, document->ids.size);
+        hashmap_reserve(document->lazy->ids, lazycount);
+    }
+
+    for(int i = 0; i < document->ids.size; i++) {
+        const element_id_t* entry = &document->ids.data[i];
+        if(entry->element == -1) {
+            add_lazy_id(document, entry->name.data, entry->name.length, entry->slot);
+        } else {
+            add_id(document, entry->name.data, entry->name.length, &elements[entry->element]);
+        }
+    }
+}
+
+static bool parse_attribute(const char** begin, const char* end, int* id, string_t* value)
+{
+    const char* it = *begin;
+    const char* name = it;
+    ++it;
+    while(it < end && IS_NAMECHAR(*it))
+        ++it;
+
+    *id = propertyid(name, it - name);
+    skip_ws(&it, end);
+    if(it >= end || *it != '=')
+        return false;
+
+    ++it;
+    skip_ws(&it, end);
+    if(it >= end || (*it != '"' && *it != '\''))
+        return false;
+
+    const char quote = *it;
+    ++it;
+    skip_ws(&it, end);
+    value->data = it;
+    it = scan_char(it, end, quote);
+    if(it >= end || *it != quote)
+        return false;
+    value->length = it - value->data;
+
+    ++it;
+    skip_ws(&it, end);
+    *begin = it;
+    return true;
+}
+
+static void add_property(otfsvg_document_t* document, element_t* element, uint32_t id, const string_t* value)
+{
+    property_t* property;
+    if(has_property(element, id)) {
+        property = document->properties.data + element->property;
+        while(property->id != id) {
+            ++property;
+        }
+    } else {
+        otfsvg_array_ensure(document->properties, 1);
+        property = &document->properties.data[document->properties.size++];
+        element->mask |= 1ull << id;
+        element->count += 1;
+    }
+
+    property->id = id;
+    property->offset = (uint32_t)(value->data - document->source);
+    property->length = (uint32_t)(value->length);
+    property->typed = 0;
+
+    otfsvg_array_ensure(document->values, 1);
+    if(parse_typed_value(document->source, id, value, &document->values.data[document->values.size])) {
+        property->typed = ++document->values.size;
+    }
+}
+
+static bool parse_attributes(const char** begin, const char* end, otfsvg_document_t* document, int element)
+{
+    const char* it = *begin;
+    while(it < end && IS_STARTNAMECHAR(*it)) {
+        int id;
+        string_t value;
+        if(!parse_attribute(&it, end, &id, &value))
+            return false;
+        if(id == ID_ID) {
+            otfsvg_array_ensure(document->ids, 1);
+            element_id_t* entry = &document->ids.data[document->ids.size++];
+            entry->name = value;
+            entry->element = element;
+            entry->slot = -1;
+        } else if(id) {
+            add_property(document, &document->elements.data[element], id, &value);
+        }
+    }
+
+    *begin = it;
+    return true;
+}
+
+static bool scan_attributes(const char** begin, const char* end, otfsvg_document_t* document, int slot)
+{
+    const char* it = *begin;
+    while(it < end && IS_STARTNAMECHAR(*it)) {
+        int id;
+        string_t value;
+        if(!parse_attribute(&it, end, &id, &value))
+            return false;
+        if(id == ID_ID && slot != -1) {
+            otfsvg_array_ensure(document->ids, 1);
+            element_id_t* entry = &document->ids.data[document->ids.size++];
+            entry->name = value;
+            entry->element = -1;
+            entry->slot = slot;
+        }
+    }
+
+    *begin = it;
+    return true;
+}
+
+static bool skip_declaration(const char** begin, const char* end)
+{
+    const char* it = *begin;
+    bool success = false;
+    if(skip_string(&it, end, "--")) {
+        const char* terminator = string_find(it, end, "-->");
+        if(terminator) {
+            it = terminator + 3;
+            success = true;
+        }
+    } else if(skip_string(&it, end, "[CDATA[")) {
+        const char* terminator = string_find(it, end, "]]>");
+        if(terminator) {
+            it = terminator + 3;
+            success = true;
+        }
+    } else if(skip_string(&it, end, "DOCTYPE")) {
+        while((it = scan_char2(it, end, '>', '[')) < end && *it == '[') {
+            ++it;
+            int depth = 1;
+            while(depth > 0 && (it = scan_char2(it, end, '[', ']')) < end) {
+                depth += (*it == '[') ? 1 : -1;
+                ++it;
+            }
+        }
+
+        if(it < end && *it == '>') {
+            it += 1;
+            success = true;
+        }
+    }
+
+    if(success)
+        skip_ws(&it, end);
+    *begin = it;
+    return success;
+}
+
+static bool skip_end_tag(const char** begin, const char* end)
+{
+    const char* it = *begin;
+    bool success = false;
+    if(it < end && IS_STARTNAMECHAR(*it)) {
+        ++it;
+        while(it < end && IS_NAMECHAR(*it))
+            ++it;
+
+        skip_ws(&it, end);
+        if(it < end && *it == '>') {
+            ++it;
+            success = true;
+        }
+    }
+
+    *begin = it;
+    return success;
+}
+
+static bool skip_xml_declaration(const char** begin, const char* end, otfsvg_document_t* document)
+{
+    const char* it = *begin;
+    bool success = false;
+    if(skip_string(&it, end, "xml")) {
+        skip_ws(&it, end);
+        if(scan_attributes(&it, end, document, -1) && skip_string(&it, end, "?>")) {
+            skip_ws(&it, end);
+            success = true;
+        }
+    }
+
+    *begin = it;
+    return success;
+}
+
+/*
+ * Skips an element the renderer does not know, from just past its name up to and including its end tag. Only the
+ * markup needed to count depth is looked at: attributes are stepped over quote to quote without being tokenized, so
+ * metadata and editor namespaces cost a few vector scans rather than a full parse.
+ */
+static bool skip_subtree(const char** begin, const char* end)
+{
+    const char* it = *begin;
+    int depth = 0;
+    bool success = false;
+    while(true) {
+        while((it = scan_char3(it, end, '>', '"', '\'')) < end && *it != '>') {
+            const char quote = *it;
+            it = scan_char(it + 1, end, quote);
+            if(it < end) {
+                ++it;
+            }
+        }
+
+        if(it >= end)
+            break;
+        if(it[-1] != '/')
+            ++depth;
+        ++it;
+
+        bool tag = false;
+        while(depth > 0) {
+            it = scan_char(it, end, '<');
+            if(it >= end)
+                break;
+
+            ++it;
+            if(it < end && *it == '/') {
+                ++it;
+                if(!skip_end_tag(&it, end))
+                    break;
+                --depth;
+                continue;
+            }
+
+            if(it < end && *it == '?') {
+                const char* terminator = string_find(it, end, "?>");
+                if(terminator == NULL)
+                    break;
+                it = terminator + 2;
+                continue;
+            }
+
+            if(it < end && *it == '!') {
+                ++it;
+                if(!skip_declaration(&it, end))
+                    break;
+                continue;
+            }
+
+            tag = it < end && IS_STARTNAMECHAR(*it);
+            break;
+        }
+
+        if(depth == 0) {
+            success = true;
+            break;
+        }
+
+        if(!tag)
+            break;
+        ++it;
+        while(it < end && IS_NAMECHAR(*it)) {
+            ++it;
+        }
+    }
+
+    *begin = it;
+    return success;
+}
+
+/*
+ * Skips the content that follows a start tag up to the next start tag, closing one level of depth per end tag.
+ * Returns true at a start tag with the position on its name, or when the depth falls back to zero.
+ */
+static bool scan_content(const char** begin, const char* end, otfsvg_document_t* document, int* depth)
+{
+    const char* it = *begin;
+    bool success = false;
+    while(*depth > 0) {
+        it = scan_char(it, end, '<');
+
+        if(it >= end)
+            break;
+
+        ++it;
+        if(it < end && *it == '/') {
+            ++it;
+            if(!skip_end_tag(&it, end))
+                break;
+
+            --*depth;
+            continue;
+        }
+
+        if(it < end && *it == '?') {
+            ++it;
+            if(!skip_xml_declaration(&it, end, document))
+                break;
+            continue;
+        }
+
+        if(it < end && *it == '!') {
+            ++it;
+            if(!skip_declaration(&it, end))
+                break;
+            continue;
+        }
+
+        success = it < end && IS_STARTNAMECHAR(*it);
+        *begin = it;
+        return success;
+    }
+
+    *begin = it;
+    return *depth == 0;
+}
+
+/*
+ * Walks the subtree of a top-level child without building it, registering the ids it contains for the slot.
+ * On failure the position is left where parse_elements would have stopped, so both modes accept the same input.
+ */
+static bool scan_subtree(const char** begin, const char* end, otfsvg_document_t* document, int slot)
+{
+    const char* it = *begin;
+    int depth = 0;
+    bool success = false;
+    while(true) {
+        const char* name = it;
+        ++it;
+        while(it < end && IS_NAMECHAR(*it))
+            ++it;
+
+        if(elementid(name, it - name) == TAG_UNKNOWN) {
+            if(!skip_subtree(&it, end))
+                break;
+        } else {
+            skip_ws(&it, end);
+            if(!scan_attributes(&it, end, document, slot))
+                break;
+
+            if(it < end && *it == '>') {
+                ++depth;
+                ++it;
+            } else if(it < end && *it == '/') {
+                ++it;
+                if(it >= end || *it != '>')
+                    break;
+                ++it;
+            } else {
+                break;
+            }
+        }
+
+        if(!scan_content(&it, end, document, &depth))
+            break;
+
+        if(depth == 0) {
+            success = true;
+            break;
+        }
+    }
+
+    *begin = it;
+    return success;
+}
+
+/*
+ * Copies the elements parsed into the document's scratch arrays into one block in the document heap, replacing the
+ * absolute indices used while parsing with offsets relative to each record.
+ */
+static element_t* commit_elements(otfsvg_document_t* document)
+{
+    element_t* elements = document->elements.data;
+    property_t* properties = document->properties.data;
+    int count = document->elements.size;
+    for(int i = count - 1; i > 0; i--) {
+        element_t* parent = &elements[elements[i].parent];
+        if(parent->end < elements[i].end) {
+            parent->end = elements[i].end;
+        }
+    }
+
+    int valuecount = 0;
+    for(int i = 0; i < document->properties.size; i++) {
+        if(properties[i].typed) {
+            valuecount += 1;
+        }
+    }
+
+    size_t elementsize = count * sizeof(element_t);
+    size_t propertysize = document->properties.size * sizeof(property_t);
+    char* block = heap_alloc(document->heap, elementsize + propertysize + valuecount * sizeof(typed_value_t));
+    element_t* newelements = (element_t*)(block);
+    property_t* newproperties = (property_t*)(block + elementsize);
+    typed_value_t* newvalues = (typed_value_t*)(block + elementsize + propertysize);
+    for(int i = 0; i < count; i++) {
+        element_t* element = &newelements[i];
+        *element = elements[i];
+        element->parent = i - elements[i].parent;
+        element->end = elements[i].end - i;
+        element->property = (uint32_t)((char*)(newproperties + elements[i].property) - (char*)(element));
+    }
+
+    for(int i = 0; i < document->properties.size; i++) {
+        property_t* property = &newproperties[i];
+        *property = properties[i];
+        if(properties[i].typed) {
+            *newvalues = document->values.data[properties[i].typed - 1];
+            property->typed = (uint32_t)((char*)(newvalues) - (char*)(property));
+            newvalues += 1;
+        }
+    }
+
+    add_ids(document, newelements);
+    return newelements;
+}
+
+static element_t* parse_elements(otfsvg_document_t* document, const char* data, size_t length, bool scan)
+{
+    otfsvg_array_clear(document->elements);
+    otfsvg_array_clear(document->properties);
+    otfsvg_array_clear(document->values);
+    otfsvg_array_clear(document->ids);
+
+    const char* it = data;
+    const char* end = it + length;
+    int current = -1;
+    while(it < end) {
+        it = scan_char(it, end, '<');
+
+        if(it >= end || *it != '<')
+            break;
+
+        ++it;
+        if(it < end && *it == '/') {
+            ++it;
+            if(!skip_end_tag(&it, end))
+                break;
+
+            if(current != -1)
+                current = document->elements.data[current].parent;
+            continue;
+        }
+
+        if(it < end && *it == '?') {
+            ++it;
+            if(!skip_xml_declaration(&it, end, document))
+                break;
+            continue;
+        }
+
+        if(it < end && *it == '!') {
+            ++it;
+            if(!skip_declaration(&it, end))
+                break;
+            continue;
+        }
+
+        if(it >= end || !IS_STARTNAMECHAR(*it))
+            break;
+
+        const char* begin = it;
+        ++it;
+        while(it < end && IS_NAMECHAR(*it))
+            ++it;
+
+        int id = elementid(begin, it - begin);
+        if(id == TAG_UNKNOWN) {
+            if(!skip_subtree(&it, end))
+                break;
+            continue;
+        }
+
+        if(scan && current == 0) {
+            lazy_t* lazy = document->lazy;
+            otfsvg_array_ensure(lazy->slots, 1);
+            lazy_slot_t* slot = &lazy->slots.data[lazy->slots.size];
+            it = begin;
+            bool success = scan_subtree(&it, end, document, lazy->slots.size);
+            slot->begin = begin - 1;
+            slot->end = it;
+            slot->element = NULL;
+            slot->state = lazy_state_unloaded;
+            lazy->slots.size += 1;
+            if(!success)
+                break;
+            continue;
+        }
+
+        if(current == -1 && document->elements.size > 0)
+            break;
+        if(current == -1 && document->root == NULL && id != TAG_SVG)
+            break;
+        int index = document->elements.size;
+        otfsvg_array_ensure(document->elements, 1);
+        element_t* element = &document->elements.data[index];
+        element->mask = 0;
+        element->style = 0;
+        element->shape = 0;
+        element->parent = current == -1 ? index : current;
+        element->end = index + 1;
+        element->property = document->properties.size;
+        element->id = id;
+        element->count = 0;
+        document->elements.size += 1;
+
+        skip_ws(&it, end);
+        if(!parse_attributes(&it, end, document, index))
+            break;
+
+        if(it < end && *it == '>') {
+            current = index;
+            ++it;
+            continue;
+        }
+
+        if(it < end && *it == '/') {
+            ++it;
+            if(it >= end || *it != '>')
+                break;
+            ++it;
+            continue;
+        }
+
+        break;
+    }
+
+    skip_ws(&it, end);
+    if(it != end || document->elements.size == 0)
+        return NULL;
+    return commit_elements(document);
+}
+
+static bool document_load(otfsvg_document_t* document, const char* data, size_t length, float width, float height, float dpi, bool lazy)
+{
+    otfsvg_document_clear(document);
+    if(is_gzip(data, length) && !gzip_inflate(&document->inflated, &data, &length))
+        return false;
+
+    if(length > UINT32_MAX)
+        return false;
+    document->source = data;
+    document->sourcelength = length;
+    document->root = parse_elements(document, data, length, lazy);
+    if(document->root == NULL) {
+        otfsvg_document_clear(document);
+        return false;
+    }
+
+    length_t w = {100, length_type_percent};
+    length_t h = {100, length_type_percent};
+
+    get_length(document->root, ID_WIDTH, &w);
+    get_length(document->root, ID_HEIGHT, &h);
+
+    otfsvg_rect_t rect = {0, 0, width, height};
+    get_view_box(document->root, ID_VIEWBOX, &rect);
+
+    document->width = convert_length(&w, rect.w, dpi);
+    document->height = convert_length(&h, rect.h, dpi);
+    document->dpi = dpi;
+    build_elements(document, document->root);
+    return true;
+}
+
+bool otfsvg_document_load(otfsvg_document_t* document, const char* data, size_t length, float width, float height, float dpi)
+{
+    return document_load(document, data, length, width, height, dpi, false);
+}
+
+bool otfsvg_document_load_lazy(otfsvg_document_t* document, const char* data, size_t length, float width, float height, float dpi)
+{
+    return document_load(document, data, length, width, height, dpi, true);
+}
+
+#ifdef _WIN32
+#define lazy_load_state(state) (*(state))
+#define lazy_store_state(state, value) (*(state) = (value))
+#define lazy_lock(lazy) ((void)(lazy))
+#define lazy_unlock(lazy) ((void)(lazy))
+#else
+#define lazy_load_state(state) __atomic_load_n(state, __ATOMIC_ACQUIRE)
+#define lazy_store_state(state, value) __atomic_store_n(state, value, __ATOMIC_RELEASE)
+#define lazy_lock(lazy) pthread_mutex_lock(&(lazy)->mutex)
+#define lazy_unlock(lazy) pthread_mutex_unlock(&(lazy)->mutex)
+#endif
+
+static bool parse_reference(const string_t* value, string_t* id)
+{
+    const char* it = value->data;
+    const char* end = it + value->length;
+    if(skip_string(&it, end, "url(") && (!skip_ws(&it, end) || !skip_delim(&it, end, '#')))
+        return false;
+    if(it == value->data && !skip_delim(&it, end, '#'))
+        return false;
+    const char* begin = it;
+    while(it < end && *it != ')')
+        ++it;
+    id->data = begin;
+    id->length = it - begin;
+    return id->length > 0;
+}
+
+static void lazy_enqueue(lazy_t* lazy, int slot)
+{
+    lazy_slot_t* entry = &lazy->slots.data[slot];
+    if(entry->state == lazy_state_unloaded) {
+        lazy_store_state(&entry->state, lazy_state_queued);
+        otfsvg_array_ensure(lazy->queue, 1);
+        lazy->queue.data[lazy->queue.size++] = slot;
+    }
+}
+
+static void lazy_enqueue_references(const otfsvg_document_t* document, const element_t* element, bool children)
+{
+    lazy_t* lazy = document->lazy;
+    const element_t* end = children ? element + element->end : element + 1;
+    for(; element < end; element++) {
+        const property_t* property = element_properties(element);
+        for(int i = 0; i < element->count; i++, property++) {
+            string_t value = {document->source + property->offset, property->length};
+            string_t id;
+            if(parse_reference(&value, &id)) {
+                int slot = (int)(intptr_t)(hashmap_get(lazy->ids, id.data, id.length));
+                if(slot > 0) {
+                    lazy_enqueue(lazy, slot - 1);
+                }
+            }
+        }
+    }
+}
+
+static void lazy_parse_slot(otfsvg_document_t* document, int index)
+{
+    lazy_t* lazy = document->lazy;
+    lazy_slot_t* slot = &lazy->slots.data[index];
+
+    lazy->current = index;
+    element_t* element = parse_elements(document, slot->begin, slot->end - slot->begin, false);
+    lazy->current = -1;
+    if(element == NULL)
+        return;
+    build_elements(document, element);
+    slot->element = element;
+}
+
+/*
+ * Parses the subtree of a top-level child (all of them when slot is -1) together with every subtree reachable
+ * through its references. Materializing does not change what the document renders, so it is done through a const
+ * document; renders that already see a loaded slot never touch the lock.
+ */
+static void lazy_load(const otfsvg_document_t* document, int slot)
+{
+    lazy_t* lazy = document->lazy;
+    if(lazy->slots.size == 0 || lazy_load_state(&lazy->complete))
+        return;
+    if(slot != -1 && lazy_load_state(&lazy->slots.data[slot].state) == lazy_state_loaded) {
+        return;
+    }
+
+    lazy_lock(lazy);
+    otfsvg_array_clear(lazy->queue);
+    if(slot == -1) {
+        for(int i = 0; i < lazy->slots.size; i++) {
+            lazy_enqueue(lazy, i);
+        }
+    } else {
+        lazy_enqueue(lazy, slot);
+    }
+
+    if(lazy->queue.size > 0)
+        lazy_enqueue_references(document, document->root, false);
+    for(int i = 0; i < lazy->queue.size; i++) {
+        int index = lazy->queue.data[i];
+        lazy_parse_slot((otfsvg_document_t*)(document), index);
+        element_t* element = lazy->slots.data[index].element;
+        if(element) {
+            lazy_enqueue_references(document, element, true);
+        }
+    }
+
+    for(int i = 0; i < lazy->queue.size; i++)
+        lazy_store_state(&lazy->slots.data[lazy->queue.data[i]].state, lazy_state_loaded);
+    if(slot == -1)
+        lazy_store_state(&lazy->complete, 1);
+    lazy_unlock(lazy);
+}
+
+/*
+ * Writes a file under a temporary name and renames it over the destination once complete, so that a reader never
+ * maps a partially written file.
+ */
+static bool replace_file(const char* filename, bool (*write)(FILE* fp, void* data), void* data)
+{
+    size_t length = strlen(filename);
+    char* temporary = malloc(length + 5);
+    memcpy(temporary, filename, length);
+    memcpy(temporary + length, ".tmp", 5);
+
+    bool success = false;
+    FILE* fp = fopen(temporary, "wb");
+    if(fp) {
+        success = write(fp, data);
+        success = fclose(fp) == 0 && success;
+#ifdef _WIN32
+        if(success)
+            remove(filename);
+#endif
+        success = success && rename(temporary, filename) == 0;
+        if(!success) {
+            remove(temporary);
+        }
+    }
+
+    free(temporary);
+    return success;
+}
+
+typedef struct {
+    const element_t* element;
+    int count;
+    int index;
+} image_block_t;
+
+typedef struct {
+    const char* data;
+    uint32_t length;
+    uint32_t element;
+} image_name_t;
+
+typedef struct {
+    char* data;
+    int size;
+    int capacity;
+} image_buffer_t;
+
+static int image_block_compare(const void* a, const void* b)
+{
+    uintptr_t first = (uintptr_t)(((const image_block_t*)(a))->element);
+    uintptr_t second = (uintptr_t)(((const image_block_t*)(b))->element);
+    return first < second ? -1 : first > second ? 1 : 0;
+}
+
+static int image_name_compare(const void* a, const void* b)
+{
+    const image_name_t* first = a;
+    const image_name_t* second = b;
+    int result = memcmp(first->data, second->data, otfsvg_min(first->length, second->length));
+    if(result == 0 && first->length != second->length)
+        return first->length < second->length ? -1 : 1;
+    return result;
+}
+
+static int image_element_index(const image_block_t* blocks, int count, const element_t* element)
+{
+    int lo = 0;
+    int hi = count - 1;
+    while(lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        const image_block_t* block = &blocks[mid];
+        if((uintptr_t)(element) < (uintptr_t)(block->element))
+            hi = mid - 1;
+        else if((uintptr_t)(element) >= (uintptr_t)(block->element + block->count))
+            lo = mid + 1;
+        else
+            return block->index + (int)(element - block->element);
+    }
+
+    return -1;
+}
+
+static uint32_t image_reserve(image_buffer_t* image, size_t size)
+{
+    size = ALIGN_SIZE(size);
+    otfsvg_array_ensure((*image), (int)(size));
+    uint32_t offset = image->size;
+    memset(image->data + offset, 0, size);
+    image->size += size;
+    return offset;
+}
+
+/*
+ * The blocks of a lazily loaded document are joined into one tree: the root is followed by the subtree of every
+ * top-level child, and each element is copied with its properties and typed values into the layout commit_elements
+ * produces, its links recomputed for their new positions.
+ */
+static bool image_build(const otfsvg_document_t* document, image_buffer_t* image)
+{
+    if(document->root == NULL || document->sourcelength > UINT32_MAX)
+        return false;
+    lazy_load(document, -1);
+
+    const lazy_t* lazy = document->lazy;
+    image_block_t* blocks = malloc((lazy->slots.size + 1) * sizeof(image_block_t));
+    int blockcount = 0;
+    int count = 0;
+    for(int i = -1; i < lazy->slots.size; i++) {
+        const element_t* element = i == -1 ? document->root : lazy->slots.data[i].element;
+        if(element) {
+            image_block_t* block = &blocks[blockcount++];
+            block->element = element;
+            block->count = element->end;
+            block->index = count;
+            count += element->end;
+        }
+    }
+
+    const element_t** elements = malloc(count * sizeof(element_t*));
+    int* parents = malloc(count * sizeof(int));
+    int* styles = malloc(count * sizeof(int));
+    const style_t** stylerecords = malloc(count * sizeof(style_t*));
+    int propertycount = 0;
+    int valuecount = 0;
+    int stylecount = 0;
+    int defaultstyle = -1;
+    size_t shapesize = 0;
+    for(int i = 0; i < blockcount; i++) {
+        for(int j = 0; j < blocks[i].count; j++) {
+            elements[blocks[i].index + j] = blocks[i].element + j;
+        }
+    }
+
+    for(int i = 0; i < count; i++) {
+        const element_t* element = elements[i];
+        const property_t* property = element_properties(element);
+        for(int j = 0; j < element->count; j++, property++) {
+            if(property->typed) {
+                valuecount += 1;
+            }
+        }
+
+        propertycount += element->count;
+        parents[i] = i == 0 || element->parent == 0 ? 0 : i - (int)(element->parent);
+
+        const style_t* style = element_style(element);
+        if(i > 0 && style == element_style(elements[parents[i]])) {
+            styles[i] = styles[parents[i]];
+        } else if(style == &default_style && defaultstyle != -1) {
+            styles[i] = defaultstyle;
+        } else {
+            if(style == &default_style)
+                defaultstyle = stylecount;
+            styles[i] = stylecount;
+            stylerecords[stylecount++] = style;
+        }
+
+        const shape_t* shape = element_shape(element);
+        if(shape) {
+            shapesize += ALIGN_SIZE(shape_size(shape));
+        }
+    }
+
+    struct {
+        image_name_t* data;
+        int size;
+        int capacity;
+    } names;
+
+    qsort(blocks, blockcount, sizeof(image_block_t), image_block_compare);
+    otfsvg_array_init(names);
+    if(document->image) {
+        const image_header_t* header = (const image_header_t*)(document->image);
+        const image_id_t* ids = (const image_id_t*)(document->image + header->ids);
+        otfsvg_array_ensure(names, (int)(header->idcount));
+        for(uint32_t i = 0; i < header->idcount; i++) {
+            image_name_t* name = &names.data[names.size++];
+            name->data = document->source + ids[i].offset;
+            name->length = ids[i].length;
+            name->element = ids[i].element;
+        }
+    } else {
+        const hashmap_t* map = document->idcache;
+        for(size_t i = 0; i < map->capacity; i++) {
+            const hashmap_entry_t* entry = &map->entries[i];
+            int index = entry->hash && entry->value ? image_element_index(blocks, blockcount, entry->value) : -1;
+            if(index != -1) {
+                otfsvg_array_ensure(names, 1);
+                image_name_t* name = &names.data[names.size++];
+                name->data = entry->data;
+                name->length = entry->length;
+                name->element = index;
+            }
+        }
+
+        if(names.size > 0) {
+            qsort(names.data, names.size, sizeof(image_name_t), image_name_compare);
+        }
+    }
+
+    int glyphcount = document->glyphs.size;
+    if(document->image)
+        glyphcount = ((const image_header_t*)(document->image))->glyphcount;
+    bool embedded = document->source == document->inflated.data
+        || (document->image && ((const image_header_t*)(document->image))->text);
+    size_t blocksize = count * sizeof(element_t) + propertycount * sizeof(property_t) + valuecount * sizeof(typed_value_t);
+    size_t total = ALIGN_SIZE(sizeof(image_header_t)) + ALIGN_SIZE(blocksize) + ALIGN_SIZE(stylecount * sizeof(style_t)) + shapesize
+        + ALIGN_SIZE(names.size * sizeof(image_id_t)) + ALIGN_SIZE(glyphcount * sizeof(uint32_t))
+        + (embedded ? ALIGN_SIZE(document->sourcelength) : 0);
+    bool success = total <= INT32_MAX;
+    if(success) {
+        uint32_t headeroffset = image_reserve(image, sizeof(image_header_t));
+        uint32_t elementoffset = image_reserve(image, blocksize);
+        uint32_t styleoffset = image_reserve(image, stylecount * sizeof(style_t));
+        uint32_t shapeoffset = image_reserve(image, shapesize);
+        uint32_t idoffset = image_reserve(image, names.size * sizeof(image_id_t));
+        uint32_t glyphoffset = image_reserve(image, glyphcount * sizeof(uint32_t));
+        uint32_t textoffset = embedded ? image_reserve(image, document->sourcelength) : 0;
+
+        image_header_t* header = (image_header_t*)(image->data + headeroffset);
+        element_t* newelements = (element_t*)(image->data + elementoffset);
+        property_t* newproperties = (property_t*)(newelements + count);
+        typed_value_t* newvalues = (typed_value_t*)(newproperties + propertycount);
+        style_t* newstyles = (style_t*)(image->data + styleoffset);
+        char* newshape = image->data + shapeoffset;
+        for(int i = 0; i < stylecount; i++)
+            newstyles[i] = *stylerecords[i];
+        for(int i = 0; i < count; i++) {
+            const element_t* old = elements[i];
+            element_t* element = &newelements[i];
+            *element = *old;
+            element->parent = i - parents[i];
+            element->end = i == 0 ? (uint32_t)(count) : old->end;
+            element->property = (uint32_t)((char*)(newproperties) - (char*)(element));
+            element->style = (char*)(&newstyles[styles[i]]) - (char*)(element);
+            element->shape = 0;
+
+            const property_t* property = element_properties(old);
+            for(int j = 0; j < old->count; j++, property++) {
+                *newproperties = *property;
+                if(property->typed) {
+                    *newvalues = *property_value(property);
+                    newproperties->typed = (uint32_t)((char*)(newvalues) - (char*)(newproperties));
+                    newvalues += 1;
+                }
+
+                newproperties += 1;
+            }
+
+            const shape_t* shape = element_shape(old);
+            if(shape) {
+                memcpy(newshape, shape, shape_size(shape));
+                element->shape = newshape - (char*)(element);
+                newshape += ALIGN_SIZE(shape_size(shape));
+            }
+        }
+
+        image_id_t* ids = (image_id_t*)(image->data + idoffset);
+        for(int i = 0; i < names.size; i++) {
+            ids[i].offset = (uint32_t)(names.data[i].data - document->source);
+            ids[i].length = names.data[i].length;
+            ids[i].element = names.data[i].element;
+        }
+
+        uint32_t* glyphs = (uint32_t*)(image->data + glyphoffset);
+        for(int i = 0; i < glyphcount; i++) {
+            const element_t* element = document->image ? image_find_glyph(document, i) : document->glyphs.data[i].element;
+            glyphs[i] = element ? image_element_index(blocks, blockcount, element) + 1 : 0;
+        }
+
+        if(embedded)
+            memcpy(image->data + textoffset, document->source, document->sourcelength);
+        memcpy(header->magic, IMAGE_MAGIC, sizeof(header->magic));
+        header->version = IMAGE_VERSION;
+        header->byteorder = IMAGE_BYTE_ORDER;
+        header->length = image->size;
+        header->sourcehash = content_hash(document->source, document->sourcelength);
+        header->sourcelength = (uint32_t)(document->sourcelength);
+        header->text = textoffset;
+        header->elements = elementoffset;
+        header->elementcount = count;
+        header->propertycount = propertycount;
+        header->valuecount = valuecount;
+        header->styles = styleoffset;
+        header->stylecount = stylecount;
+        header->shapes = shapeoffset;
+        header->shapesize = (uint32_t)(shapesize);
+        header->ids = idoffset;
+        header->idcount = names.size;
+        header->glyphs = glyphoffset;
+        header->glyphcount = glyphcount;
+        header->glyphbase = document->glyphbase;
+        header->width = document->width;
+        header->height = document->height;
+        header->dpi = document->dpi;
+    }
+
+    otfsvg_array_destroy(names);
+    free(stylerecords);
+    free(styles);
+    free(parents);
+    free(elements);
+    free(blocks);
+    return success;
+}
+
+static bool image_write(FILE* fp, void* data)
+{
+    image_buffer_t image;
+    otfsvg_array_init(image);
+    bool success = image_build(data, &image) && fwrite(image.data, image.size, 1, fp) == 1;
+    otfsvg_array_destroy(image);
+    return success;
+}
+
+bool otfsvg_document_write_image(const otfsvg_document_t* document, const char* filename)
+{
+    return replace_file(filename, image_write, (void*)(document));
+}
+
+static inline bool image_range(uint64_t offset, uint64_t length, uint64_t size)
+{
+    return offset <= size && length <= size - offset;
+}
+
+static inline bool image_paint_check(const paint_t* paint, uint32_t sourcelength)
+{
+    return image_range(paint->idoffset, paint->idlength, sourcelength);
+}
+
+/*
+ * Checks every link of an image before any of it is followed: the tree structure, the property and typed value
+ * records of each element and the offsets they hold into the document text, the style and shape of each element, and
+ * the id and glyph tables.
+ */
+static bool image_check(const char* data, size_t length, const char* source, size_t sourcelength, const char** text)
+{
+    if(length < sizeof(image_header_t) || (uintptr_t)(data) % 8 != 0)
+        return false;
+
+    const image_header_t* header = (const image_header_t*)(data);
+    if(memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0
+        || header->version != IMAGE_VERSION
+        || header->byteorder != IMAGE_BYTE_ORDER
+        || header->length != length
+        || header->elementcount == 0
+        || header->glyphbase < 0 || header->glyphbase > 65535 || header->glyphcount > 65536
+        || !isfinite(header->width) || !isfinite(header->height) || !isfinite(header->dpi)) {
+        return false;
+    }
+
+    uint64_t blocksize = (uint64_t)(header->elementcount) * sizeof(element_t)
+        + (uint64_t)(header->propertycount) * sizeof(property_t) + (uint64_t)(header->valuecount) * sizeof(typed_value_t);
+    if(header->elements % 8 != 0 || !image_range(header->elements, blocksize, length)
+        || header->styles % 8 != 0 || !image_range(header->styles, (uint64_t)(header->stylecount) * sizeof(style_t), length)
+        || header->shapes % 8 != 0 || !image_range(header->shapes, header->shapesize, length)
+        || header->ids % 8 != 0 || !image_range(header->ids, (uint64_t)(header->idcount) * sizeof(image_id_t), length)
+        || header->glyphs % 8 != 0 || !image_range(header->glyphs, (uint64_t)(header->glyphcount) * sizeof(uint32_t), length)) {
+        return false;
+    }
+
+    if(header->text) {
+        if(!image_range(header->text, header->sourcelength, length))
+            return false;
+        source = data + header->text;
+    } else if(source == NULL || sourcelength != header->sourcelength || content_hash(source, sourcelength) != header->sourcehash) {
+        return false;
+    }
+
+    const element_t* elements = (const element_t*)(data + header->elements);
+    const property_t* properties = (const property_t*)(elements + header->elementcount);
+    const typed_value_t* values = (const typed_value_t*)(properties + header->propertycount);
+    const char* styles = data + header->styles;
+    const char* shapes = data + header->shapes;
+    for(uint32_t i = 0; i < header->stylecount; i++) {
+        const style_t* style = (const style_t*)(styles) + i;
+        if(!image_paint_check(&style->fill, header->sourcelength) || !image_paint_check(&style->stroke, header->sourcelength)) {
+            return false;
+        }
+    }
+
+    for(uint32_t i = 0; i < header->elementcount; i++) {
+        const element_t* element = &elements[i];
+        if(i == 0 && (element->parent != 0 || element->end != header->elementcount))
+            return false;
+        if(i > 0) {
+            if(element->parent == 0 || element->parent > i)
+                return false;
+            const element_t* parent = element - element->parent;
+            if(element->end == 0 || (uint64_t)(i) + element->end > (uint64_t)(i - element->parent) + parent->end) {
+                return false;
+            }
+        }
+
+        uint64_t position = (uint64_t)((const char*)(element) - (const char*)(properties)) + element->property;
+        if(position % sizeof(property_t) != 0 || !image_range(position / sizeof(property_t), element->count, header->propertycount)) {
+            return false;
+        }
+
+        uint64_t mask = 0;
+        const property_t* property = element_properties(element);
+        for(int j = 0; j < element->count; j++, property++) {
+            if(property->id >= ID_COUNT || !image_range(property->offset, property->length, header->sourcelength))
+                return false;
+            mask |= 1ull << property->id;
+            if(property->typed == 0)
+                continue;
+            position = (uint64_t)((const char*)(property) - (const char*)(values)) + property->typed;
+            if(position % sizeof(typed_value_t) != 0 || position / sizeof(typed_value_t) >= header->valuecount)
+                return false;
+            if((property->id == ID_FILL || property->id == ID_STROKE) && !image_paint_check(&property_value(property)->paint, header->sourcelength)) {
+                return false;
+            }
+        }
+
+        if(mask != element->mask)
+            return false;
+        position = (uint64_t)((const char*)(element) - styles) + (uint64_t)(element->style);
+        if(position % sizeof(style_t) != 0 || position / sizeof(style_t) >= header->stylecount)
+            return false;
+        if(element->shape == 0)
+            continue;
+        position = (uint64_t)((const char*)(element) - shapes) + (uint64_t)(element->shape);
+        if(position % 8 != 0 || !image_range(position, sizeof(shape_t), header->shapesize))
+            return false;
+        const shape_t* shape = element_shape(element);
+        uint64_t size = sizeof(shape_t) + (uint64_t)(shape->points) * sizeof(otfsvg_point_t) + (uint64_t)(shape->commands) * sizeof(otfsvg_path_command_t);
+        otfsvg_path_t path;
+        if(!image_range(position, size, header->shapesize))
+            return false;
+        shape_path(shape, &path);
+        if(!path_check(path.commands.data, shape->commands, shape->points)) {
+            return false;
+        }
+    }
+
+    const image_id_t* ids = (const image_id_t*)(data + header->ids);
+    for(uint32_t i = 0; i < header->idcount; i++) {
+        if(!image_range(ids[i].offset, ids[i].length, header->sourcelength) || ids[i].element >= header->elementcount) {
+            return false;
+        }
+    }
+
+    const uint32_t* glyphs = (const uint32_t*)(data + header->glyphs);
+    for(uint32_t i = 0; i < header->glyphcount; i++) {
+        if(glyphs[i] > header->elementcount) {
+            return false;
+        }
+    }
+
+    *text = source;
+    return true;
+}
+
+bool otfsvg_document_load_image(otfsvg_document_t* document, const char* data, size_t length, const char* source, size_t source_length)
+{
+    otfsvg_document_clear(document);
+    const char* text = NULL;
+    if(!image_check(data, length, source, source_length, &text))
+        return false;
+
+    const image_header_t* header = (const image_header_t*)(data);
+    document->image = data;
+    document->source = text;
+    document->sourcelength = header->sourcelength;
+    document->root = (element_t*)(data + header->elements);
+    document->glyphbase = header->glyphbase;
+    document->width = header->width;
+    document->height = header->height;
+    document->dpi = header->dpi;
+    return true;
+}
+
+#ifdef _WIN32
+bool otfsvg_document_load_image_from_file(otfsvg_document_t* document, const char* filename, const char* source, size_t source_length)
+{
+    otfsvg_document_clear(document);
+    FILE* fp = fopen(filename, "rb");
+    if(fp == NULL)
+        return false;
+
+    fseek(fp, 0, SEEK_END);
+    long length = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    char* data = NULL;
+    bool success = length > 0 && (data = malloc(length)) && fread(data, length, 1, fp) == 1
+        && otfsvg_document_load_image(document, data, length, source, source_length);
+    fclose(fp);
+    if(!success) {
+        free(data);
+        return false;
+    }
+
+    document->mapping = data;
+    document->mappinglength = length;
+    return true;
+}
+#else
+bool otfsvg_document_load_image_from_file(otfsvg_document_t* document, const char* filename, const char* source, size_t source_length)
+{
+    otfsvg_document_clear(document);
+    int fd = open(filename, O_RDONLY);
+    if(fd == -1)
+        return false;
+
+    struct stat st;
+    if(fstat(fd, &st) == -1 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+
+    size_t length = (size_t)(st.st_size);
+    char* mapping = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+        return false;
+
+    if(!otfsvg_document_load_image(document, mapping, length, source, source_length)) {
+        munmap(mapping, length);
+        return false;
+    }
+
+    document->mapping = mapping;
+    document->mappinglength = length;
+    return true;
+}
+#endif
+
+typedef struct {
+    const char* id;
+    uint32_t idlength;
+    uint32_t offset;
+    uint32_t length;
+    int tag;
+} index_entry_t;
+
+typedef struct {
+    uint32_t offset;
+    int first;
+    int last;
+} index_open_t;
+
+struct otfsvg_index {
+    const char* data;
+    size_t length;
+    struct {
+        index_entry_t* data;
+        int size;
+        int capacity;
+    } entries;
+    struct {
+        index_open_t* data;
+        int size;
+        int capacity;
+    } stack;
+    inflate_buffer_t inflated;
+};
+
+otfsvg_index_t* otfsvg_index_create(void)
+{
+    otfsvg_index_t* index = malloc(sizeof(otfsvg_index_t));
+    index->data = NULL;
+    index->length = 0;
+    otfsvg_array_init(index->entries);
+    otfsvg_array_init(index->stack);
+    index->inflated.data = NULL;
+    index->inflated.capacity = 0;
+    return index;
+}
+
+void otfsvg_index_destroy(otfsvg_index_t* index)
+{
+    otfsvg_array_destroy(index->entries);
+    otfsvg_array_destroy(index->stack);
+    free(index->inflated.data);
+    free(index);
+}
+
+void otfsvg_index_clear(otfsvg_index_t* index)
+{
+    index->data = NULL;
+    index->length = 0;
+    otfsvg_array_clear(index->entries);
+    otfsvg_array_clear(index->stack);
+}
+
+static bool index_attributes(const char** begin, const char* end, otfsvg_index_t* index, int tag, uint32_t offset)
+{
+    const char* it = *begin;
+    while(it < end && IS_STARTNAMECHAR(*it)) {
+        int id;
+        string_t value;
+        if(!parse_attribute(&it, end, &id, &value))
+            return false;
+        if(id == ID_ID) {
+            otfsvg_array_ensure(index->entries, 1);
+            index_entry_t* entry = &index->entries.data[index->entries.size];
+            entry->id = value.data;
+            entry->idlength = value.length;
+            entry->offset = offset;
+            entry->length = 0;
+            entry->tag = tag;
+            index->entries.size += 1;
+        }
+    }
+
+    *begin = it;
+    return true;
+}
+
+static void index_close(otfsvg_index_t* index, int first, int last, uint32_t offset, uint32_t end)
+{
+    for(int i = first; i < last; i++) {
+        index->entries.data[i].length = end - offset;
+    }
+}
+
+static int index_entry_compare(const void* a, const void* b)
+{
+    const index_entry_t* ea = a;
+    const index_entry_t* eb = b;
+    uint32_t length = otfsvg_min(ea->idlength, eb->idlength);
+    int result = memcmp(ea->id, eb->id, length);
+    if(result == 0 && ea->idlength != eb->idlength)
+        result = (ea->idlength < eb->idlength) ? -1 : 1;
+    if(result == 0 && ea->offset != eb->offset)
+        result = (ea->offset < eb->offset) ? -1 : 1;
+    return result;
+}
+
+/*
+ * Mirrors the grammar of parse_elements, so a document is indexed exactly when it would load, but keeps only a stack
+ * of the open elements instead of the tree. As there, the end tag of the root leaves it open, so later elements are
+ * taken as its children, while any element after a root that closed itself ends the document.
+ */
+static bool index_elements(otfsvg_index_t* index, const char* data, size_t length)
+{
+    const char* it = data;
+    const char* end = it + length;
+
+    bool root = false;
+    while(it < end) {
+        it = scan_char(it, end, '<');
+
+        if(it >= end || *it != '<')
+            break;
+
+        ++it;
+        if(it < end && *it == '/') {
+            ++it;
+            if(!skip_end_tag(&it, end))
+                break;
+
+            if(index->stack.size > 1) {
+                index_open_t* open = &index->stack.data[--index->stack.size];
+                index_close(index, open->first, open->last, open->offset, it - data);
+            } else if(index->stack.size == 1) {
+                index_open_t* open = &index->stack.data[0];
+                index_close(index, open->first, open->last, open->offset, it - data);
+                open->last = open->first;
+            }
+
+            continue;
+        }
+
+        if(it < end && *it == '?') {
+            ++it;
+            if(!skip_xml_declaration(&it, end, NULL))
+                break;
+            continue;
+        }
+
+        if(it < end && *it == '!') {
+            ++it;
+            if(!skip_declaration(&it, end))
+                break;
+            continue;
+        }
+
+        if(it >= end || !IS_STARTNAMECHAR(*it))
+            break;
+
+        uint32_t offset = it - data - 1;
+        const char* begin = it;
+        ++it;
+        while(it < end && IS_NAMECHAR(*it))
+            ++it;
+
+        int tag = elementid(begin, it - begin);
+        if(tag == TAG_UNKNOWN) {
+            if(!skip_subtree(&it, end))
+                break;
+            continue;
+        }
+
+        if(!root) {
+            if(tag != TAG_SVG)
+                break;
+            root = true;
+        } else if(index->stack.size == 0) {
+            break;
+        }
+
+        int first = index->entries.size;
+        skip_ws(&it, end);
+        if(!index_attributes(&it, end, index, tag, offset))
+            break;
+
+        if(it < end && *it == '>') {
+            otfsvg_array_ensure(index->stack, 1);
+            index_open_t* open = &index->stack.data[index->stack.size++];
+            open->offset = offset;
+            open->first = first;
+            open->last = index->entries.size;
+            ++it;
+            continue;
+        }
+
+        if(it < end && *it == '/') {
+            ++it;
+            if(it >= end || *it != '>')
+                break;
+
+            ++it;
+            index_close(index, first, index->entries.size, offset, it - data);
+            continue;
+        }
+
+        break;
+    }
+
+    skip_ws(&it, end);
+    for(int i = 0; i < index->entries.size; i++) {
+        index_entry_t* entry = &index->entries.data[i];
+        if(entry->length == 0) {
+            entry->length = length - entry->offset;
+        }
+    }
+
+    return root && it == end;
+}
+
+bool otfsvg_index_load(otfsvg_index_t* index, const char* data, size_t length)
+{
+    otfsvg_index_clear(index);
+    if(is_gzip(data, length) && !gzip_inflate(&index->inflated, &data, &length))
+        return false;
+    if(length > UINT32_MAX || !index_elements(index, data, length)) {
+        otfsvg_index_clear(index);
+        return false;
+    }
+
+    if(index->entries.size > 1)
+        qsort(index->entries.data, index->entries.size, sizeof(index_entry_t), index_entry_compare);
+    index->data = data;
+    index->length = length;
+    return true;
+}
+
+const char* otfsvg_index_data(const otfsvg_index_t* index, size_t* length)
+{
+    *length = index->length;
+    return index->data;
+}
+
+int otfsvg_index_count(const otfsvg_index_t* index)
+{
+    return index->entries.size;
+}
+
+static void index_get_entry(const index_entry_t* entry, otfsvg_index_entry_t* value)
+{
+    value->id = entry->id;
+    value->id_length = entry->idlength;
+    value->tag = elementmap[entry->tag - 1].name;
+    value->offset = entry->offset;
+    value->length = entry->length;
+}
+
+bool otfsvg_index_entry_at(const otfsvg_index_t* index, int at, otfsvg_index_entry_t* entry)
+{
+    if(at < 0 || at >= index->entries.size)
+        return false;
+    index_get_entry(&index->entries.data[at], entry);
+    return true;
+}
+
+static bool index_find(const otfsvg_index_t* index, const char* id, size_t length, otfsvg_index_entry_t* entry)
+{
+    int lo = 0;
+    int hi = index->entries.size;
+    while(lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        const index_entry_t* current = &index->entries.data[mid];
+        uint32_t size = otfsvg_min(current->idlength, length);
+        int result = memcmp(current->id, id, size);
+        if(result < 0 || (result == 0 && current->idlength <= length)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if(lo == 0)
+        return false;
+    const index_entry_t* found = &index->entries.data[lo - 1];
+    if(found->idlength != length || memcmp(found->id, id, length) != 0)
+        return false;
+    index_get_entry(found, entry);
+    return true;
+}
+
+bool otfsvg_index_find(const otfsvg_index_t* index, const char* id, otfsvg_index_entry_t* entry)
+{
+    return index_find(index, id, strlen(id), entry);
+}
+
+bool otfsvg_index_find_glyph(const otfsvg_index_t* index, uint16_t glyph, otfsvg_index_entry_t* entry)
+{
+    char name[16];
+    int length = snprintf(name, sizeof(name), "glyph%u", glyph);
+    return index_find(index, name, length, entry);
+}
+
+float otfsvg_document_width(const otfsvg_document_t* document)
+{
+    return document->width;
+}
+
+float otfsvg_document_height(const otfsvg_document_t* document)
+{
+    return document->height;
+}
+
+void otfsvg_document_set_matrix(otfsvg_document_t* document, const otfsvg_matrix_t* matrix)
+{
+    document->matrix = *matrix;
+}
+
+void otfsvg_document_get_matrix(const otfsvg_document_t* document, otfsvg_matrix_t* matrix)
+{
+    *matrix = document->matrix;
+}
+
+static void context_begin(otfsvg_render_context_t* context, const otfsvg_document_t* document, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color)
+{
+    context->document = document;
+    context->canvas = canvas;
+    context->canvas_data = canvas_data;
+    context->palette_func = palette_func;
+    context->palette_data = palette_data;
+    context->current_color = current_color;
+    context->overrides = NULL;
+    context->clip = NULL;
+    context->isolation = NULL;
+    memset(&context->stats, 0, sizeof(context->stats));
+}
+
+static void context_end(otfsvg_render_context_t* context)
+{
+    context->document = NULL;
+    context->canvas = NULL;
+    context->canvas_data = NULL;
+}
+
+static void context_draw(otfsvg_render_context_t* context, render_state_t* state, const element_t* element)
+{
+    otfsvg_rect_init(&state->bbox, FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX);
+    state->opacity = 1.f;
+    state->compositing = false;
+    if(element == NULL) {
+        state->element = context->document->root;
+        render_svg(context, state, state->element);
+    } else {
+        state->element = element;
+        render_element(context, state, state->element);
+    }
+}
+
+static bool context_render(otfsvg_render_context_t* context, const otfsvg_document_t* document, const otfsvg_matrix_t* matrix, const otfsvg_rect_t* clip, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, const element_t* element)
+{
+    if(element == NULL || element == document->root)
+        lazy_load(document, -1);
+    context_begin(context, document, canvas, canvas_data, palette_func, palette_data, current_color);
+    context->clip = clip;
+
+    render_state_t state;
+    state.mode = render_mode_display;
+    state.matrix = matrix ? *matrix : document->matrix;
+    context_draw(context, &state, element);
+    context_end(context);
+    return true;
+}
+
+static bool context_rect(otfsvg_render_context_t* context, const otfsvg_document_t* document, const otfsvg_matrix_t* matrix, otfsvg_rect_t* rect, const element_t* element)
+{
+    if(element == NULL || element == document->root)
+        lazy_load(document, -1);
+    context_begin(context, document, NULL, NULL, NULL, NULL, otfsvg_black_color);
+
+    render_state_t state;
+    state.mode = render_mode_bounding;
+    state.matrix = matrix ? *matrix : document->matrix;
+    context_draw(context, &state, element);
+    if(state.bbox.w >= 0 && state.bbox.h >= 0)
+        otfsvg_matrix_map_rect(&state.matrix, &state.bbox, rect);
+    context_end(context);
+    return true;
+}
+
+static const element_t* find_glyph(const otfsvg_document_t* document, uint16_t glyph)
+{
+    int index = glyph - document->glyphbase;
+    if(document->image)
+        return image_find_glyph(document, index);
+    if(index < 0 || index >= document->glyphs.size)
+        return NULL;
+    const glyph_t* entry = &document->glyphs.data[index];
+    if(entry->slot > 0)
+        lazy_load(document, entry->slot - 1);
+    return entry->element;
+}
+
+static bool find_target(const otfsvg_document_t* document, const char* id, const element_t** element)
+{
+    *element = NULL;
+    if(document->root == NULL)
+        return false;
+    if(id != NULL) {
+        string_t name = {id, strlen(id)};
+        int slot = (int)(intptr_t)(hashmap_get(document->lazy->ids, name.data, name.length));
+        if(slot > 0)
+            lazy_load(document, slot - 1);
+        *element = find_element(document, &name);
+        if(*element == NULL) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool otfsvg_render_context_render(otfsvg_render_context_t* context, const otfsvg_document_t* document, const otfsvg_matrix_t* matrix, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, const char* id)
+{
+    const element_t* element;
+    if(!find_target(document, id, &element))
+        return false;
+    return context_render(context, document, matrix, NULL, canvas, canvas_data, palette_func, palette_data, current_color, element);
+}
+
+bool otfsvg_render_context_render_glyph(otfsvg_render_context_t* context, const otfsvg_document_t* document, const otfsvg_matrix_t* matrix, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, uint16_t glyph)
+{
+    const element_t* element = find_glyph(document, glyph);
+    if(element == NULL)
+        return false;
+    return context_render(context, document, matrix, NULL, canvas, canvas_data, palette_func, palette_data, current_color, element);
+}
+
+bool otfsvg_render_context_render_clipped(otfsvg_render_context_t* context, const otfsvg_document_t* document, const otfsvg_matrix_t* matrix, const otfsvg_rect_t* clip, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, const char* id)
+{
+    const element_t* element;
+    if(!find_target(document, id, &element))
+        return false;
+    return context_render(context, document, matrix, clip, canvas, canvas_data, palette_func, palette_data, current_color, element);
+}
+
+bool otfsvg_render_context_render_glyph_clipped(otfsvg_render_context_t* context, const otfsvg_document_t* document, const otfsvg_matrix_t* matrix, const otfsvg_rect_t* clip, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, uint16_t glyph)
+{
+    const element_t* element = find_glyph(document, glyph);
+    if(element == NULL)
+        return false;
+    return context_render(context, document, matrix, clip, canvas, canvas_data, palette_func, palette_data, current_color, element);
+}
+
+void otfsvg_render_context_get_stats(const otfsvg_render_context_t* context, otfsvg_render_stats_t* stats)
+{
+    *stats = context->stats;
+}
+
+bool otfsvg_render_context_rect(otfsvg_render_context_t* context, const otfsvg_document_t* document, const otfsvg_matrix_t* matrix, otfsvg_rect_t* rect, const char* id)
+{
+    otfsvg_rect_init(rect, 0, 0, 0, 0);
+    const element_t* element;
+    if(!find_target(document, id, &element))
+        return false;
+    return context_rect(context, document, matrix, rect, element);
+}
+
+bool otfsvg_render_context_rect_glyph(otfsvg_render_context_t* context, const otfsvg_document_t* document, const otfsvg_matrix_t* matrix, otfsvg_rect_t* rect, uint16_t glyph)
+{
+    otfsvg_rect_init(rect, 0, 0, 0, 0);
+    const element_t* element = find_glyph(document, glyph);
+    if(element == NULL)
+        return false;
+    return context_rect(context, document, matrix, rect, element);
+}
+
+bool otfsvg_render_context_render_run(otfsvg_render_context_t* context, const otfsvg_document_t* document, const otfsvg_matrix_t* matrix, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, const otfsvg_glyph_position_t* glyphs, int count)
+{
+    otfsvg_matrix_t base = matrix ? *matrix : document->matrix;
+    bool success = true;
+    render_state_t state;
+    state.mode = render_mode_display;
+    context_begin(context, document, canvas, canvas_data, palette_func, palette_data, current_color);
+    for(int i = 0; i < count; i++) {
+        const element_t* element = find_glyph(document, glyphs[i].glyph);
+        if(element == NULL) {
+            success = false;
+            continue;
+        }
+
+        if(element == document->root)
+            lazy_load(document, -1);
+        state.matrix = base;
+        state.matrix.m02 += glyphs[i].x;
+        state.matrix.m12 += glyphs[i].y;
+        context_draw(context, &state, element);
+    }
+
+    context_end(context);
+    return success;
+}
+
+bool otfsvg_document_render(otfsvg_document_t* document, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, const char* id)
+{
+    return otfsvg_render_context_render(document->context, document, NULL, canvas, canvas_data, palette_func, palette_data, current_color, id);
+}
+
+bool otfsvg_document_render_glyph(otfsvg_document_t* document, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, uint16_t glyph)
+{
+    return otfsvg_render_context_render_glyph(document->context, document, NULL, canvas, canvas_data, palette_func, palette_data, current_color, glyph);
+}
+
+bool otfsvg_document_render_run(otfsvg_document_t* document, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, const otfsvg_glyph_position_t* glyphs, int count)
+{
+    return otfsvg_render_context_render_run(document->context, document, NULL, canvas, canvas_data, palette_func, palette_data, current_color, glyphs, count);
+}
+
+bool otfsvg_document_render_clipped(otfsvg_document_t* document, const otfsvg_rect_t* clip, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, const char* id)
+{
+    return otfsvg_render_context_render_clipped(document->context, document, NULL, clip, canvas, canvas_data, palette_func, palette_data, current_color, id);
+}
+
+bool otfsvg_document_render_glyph_clipped(otfsvg_document_t* document, const otfsvg_rect_t* clip, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, uint16_t glyph)
+{
+    return otfsvg_render_context_render_glyph_clipped(document->context, document, NULL, clip, canvas, canvas_data, palette_func, palette_data, current_color, glyph);
+}
+
+void otfsvg_document_get_stats(const otfsvg_document_t* document, otfsvg_render_stats_t* stats)
+{
+    otfsvg_render_context_get_stats(document->context, stats);
+}
+
+bool otfsvg_document_rect(otfsvg_document_t* document, otfsvg_rect_t* rect, const char* id)
+{
+    return otfsvg_render_context_rect(document->context, document, NULL, rect, id);
+}
+
+bool otfsvg_document_rect_glyph(otfsvg_document_t* document, otfsvg_rect_t* rect, uint16_t glyph)
+{
+    return otfsvg_render_context_rect_glyph(document->context, document, NULL, rect, glyph);
+}
+
+static otfsvg_display_list_t* display_list_compile(const otfsvg_document_t* document, const element_t* element)
+{
+    if(element == NULL || element == document->root)
+        lazy_load(document, -1);
+    otfsvg_display_list_t* list = malloc(sizeof(otfsvg_display_list_t));
+    list->matrix = document->matrix;
+    otfsvg_array_init(list->commands);
+    otfsvg_array_init(list->paths);
+    otfsvg_array_init(list->pathcommands);
+    otfsvg_array_init(list->points);
+    otfsvg_array_init(list->paints);
+    otfsvg_array_init(list->colors);
+    otfsvg_array_init(list->stops);
+    otfsvg_array_init(list->strokes);
+    otfsvg_array_init(list->dashes);
+    otfsvg_array_init(list->strings);
+    list->shape = NULL;
+
+    otfsvg_render_context_t* context = otfsvg_render_context_create();
+    context_begin(context, document, NULL, NULL, NULL, NULL, otfsvg_black_color);
+    context->recorder = list;
+
+    render_state_t state;
+    state.mode = render_mode_display;
+    otfsvg_matrix_init_identity(&state.matrix);
+    context_draw(context, &state, element);
+    context->recorder = NULL;
+
+    state.mode = render_mode_bounding;
+    otfsvg_matrix_init_identity(&state.matrix);
+    context_draw(context, &state, element);
+    list->bbox = state.bbox;
+    list->shape = NULL;
+
+    context_end(context);
+    otfsvg_render_context_destroy(context);
+    return list;
+}
+
+otfsvg_display_list_t* otfsvg_display_list_create(const otfsvg_document_t* document, const char* id)
+{
+    const element_t* element;
+    if(!find_target(document, id, &element))
+        return NULL;
+    return display_list_compile(document, element);
+}
+
+otfsvg_display_list_t* otfsvg_display_list_create_glyph(const otfsvg_document_t* document, uint16_t glyph)
+{
+    const element_t* element = find_glyph(document, glyph);
+    if(element == NULL)
+        return NULL;
+    return display_list_compile(document, element);
+}
+
+void otfsvg_display_list_destroy(otfsvg_display_list_t* list)
+{
+    if(list == NULL)
+        return;
+    otfsvg_array_destroy(list->commands);
+    otfsvg_array_destroy(list->paths);
+    otfsvg_array_destroy(list->pathcommands);
+    otfsvg_array_destroy(list->points);
+    otfsvg_array_destroy(list->paints);
+    otfsvg_array_destroy(list->colors);
+    otfsvg_array_destroy(list->stops);
+    otfsvg_array_destroy(list->strokes);
+    otfsvg_array_destroy(list->dashes);
+    otfsvg_array_destroy(list->strings);
+    free(list);
+}
+
+bool otfsvg_display_list_rect(const otfsvg_display_list_t* list, const otfsvg_matrix_t* matrix, otfsvg_rect_t* rect)
+{
+    otfsvg_rect_init(rect, 0, 0, 0, 0);
+    if(list->bbox.w >= 0 && list->bbox.h >= 0)
+        otfsvg_matrix_map_rect(matrix ? matrix : &list->matrix, &list->bbox, rect);
+    return true;
+}
+
+typedef enum {
+    display_table_commands,
+    display_table_paths,
+    display_table_pathcommands,
+    display_table_points,
+    display_table_paints,
+    display_table_colors,
+    display_table_stops,
+    display_table_strokes,
+    display_table_dashes,
+    display_table_strings,
+    display_table_count
+} display_table_t;
+
+static const size_t display_table_sizes[display_table_count] = {
+    sizeof(display_command_t),
+    sizeof(display_path_t),
+    sizeof(otfsvg_path_command_t),
+    sizeof(otfsvg_point_t),
+    sizeof(display_paint_t),
+    sizeof(display_color_t),
+    sizeof(otfsvg_gradient_stop_t),
+    sizeof(display_stroke_t),
+    sizeof(float),
+    sizeof(char)
+};
+
+/*
+ * The tables of a display list as plain arrays, either owned by a list or read in place from a glyph cache.
+ */
+typedef struct {
+    const display_command_t* commands;
+    const display_path_t* paths;
+    const otfsvg_path_command_t* pathcommands;
+    const otfsvg_point_t* points;
+    const display_paint_t* paints;
+    const display_color_t* colors;
+    const otfsvg_gradient_stop_t* stops;
+    const display_stroke_t* strokes;
+    const float* dashes;
+    const char* strings;
+    uint32_t count[display_table_count];
+} display_tables_t;
+
+static void display_list_tables(const otfsvg_display_list_t* list, display_tables_t* tables)
+{
+    tables->commands = list->commands.data;
+    tables->paths = list->paths.data;
+    tables->pathcommands = list->pathcommands.data;
+    tables->points = list->points.data;
+    tables->paints = list->paints.data;
+    tables->colors = list->colors.data;
+    tables->stops = list->stops.data;
+    tables->strokes = list->strokes.data;
+    tables->dashes = list->dashes.data;
+    tables->strings = list->strings.data;
+    tables->count[display_table_commands] = list->commands.size;
+    tables->count[display_table_paths] = list->paths.size;
+    tables->count[display_table_pathcommands] = list->pathcommands.size;
+    tables->count[display_table_points] = list->points.size;
+    tables->count[display_table_paints] = list->paints.size;
+    tables->count[display_table_colors] = list->colors.size;
+    tables->count[display_table_stops] = list->stops.size;
+    tables->count[display_table_strokes] = list->strokes.size;
+    tables->count[display_table_dashes] = list->dashes.size;
+    tables->count[display_table_strings] = list->strings.size;
+}
+
+static inline bool display_range_valid(uint32_t offset, uint32_t length, uint32_t count)
+{
+    return offset <= count && length <= count - offset;
+}
+
+/*
+ * Checks that every index of the tables stays within bounds, that every path has the points its commands consume, that
+ * every enumerated value is one the canvas accepts and that groups are balanced, so that tables read from a file can be
+ * replayed without trusting their content.
+ */
+static bool display_tables_check(const display_tables_t* tables)
+{
+    const uint32_t* count = tables->count;
+    if(count[display_table_colors] != count[display_table_stops])
+        return false;
+    for(uint32_t i = 0; i < count[display_table_paths]; i++) {
+        const display_path_t* path = &tables->paths[i];
+        if(!display_range_valid(path->commands, path->commandcount, count[display_table_pathcommands])
+            || !display_range_valid(path->points, path->pointcount, count[display_table_points])) {
+            return false;
+        }
+
+        if(!path_check(tables->pathcommands + path->commands, path->commandcount, path->pointcount)) {
+            return false;
+        }
+    }
+
+    for(uint32_t i = 0; i < count[display_table_paints]; i++) {
+        const display_paint_t* paint = &tables->paints[i];
+        if(!display_range_valid(paint->colors, paint->count, count[display_table_colors]))
+            return false;
+        if(paint->type != otfsvg_paint_type_color && paint->type != otfsvg_paint_type_gradient)
+            return false;
+        if(paint->gradienttype > otfsvg_gradient_type_radial || paint->spread > otfsvg_gradient_spread_repeat)
+            return false;
+        if(paint->type == otfsvg_paint_type_color && paint->count == 0) {
+            return false;
+        }
+    }
+
+    for(uint32_t i = 0; i < count[display_table_colors]; i++) {
+        const display_color_t* color = &tables->colors[i];
+        if(color->type > color_type_current)
+            return false;
+        if(color->palette && !display_range_valid(color->palette - 1, color->length, count[display_table_strings])) {
+            return false;
+        }
+    }
+
+    for(uint32_t i = 0; i < count[display_table_strokes]; i++) {
+        const display_stroke_t* stroke = &tables->strokes[i];
+        if(stroke->linecap > otfsvg_line_cap_square || stroke->linejoin > otfsvg_line_join_bevel)
+            return false;
+        if(!display_range_valid(stroke->dashes, stroke->dashcount, count[display_table_dashes])) {
+            return false;
+        }
+    }
+
+    uint32_t depth = 0;
+    for(uint32_t i = 0; i < count[display_table_commands]; i++) {
+        const display_command_t* command = &tables->commands[i];
+        switch(command->type) {
+        case display_command_fill:
+        case display_command_stroke:
+            if(command->path >= count[display_table_paths] || command->paint >= count[display_table_paints])
+                return false;
+            if(command->type == display_command_stroke && command->stroke >= count[display_table_strokes])
+                return false;
+            if(command->mode > otfsvg_fill_rule_even_odd)
+                return false;
+            break;
+        case display_command_push_group:
+            if(command->mode > otfsvg_blend_mode_dst_in)
+                return false;
+            depth += 1;
+            break;
+        case display_command_pop_group:
+            if(command->mode > otfsvg_blend_mode_dst_in || depth == 0)
+                return false;
+            depth -= 1;
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return depth == 0;
+}
+
+typedef struct {
+    otfsvg_gradient_stop_t* data;
+    int size;
+    int capacity;
+} display_stops_t;
+
+static void display_tables_paint(const display_tables_t* tables, const display_paint_t* entry, otfsvg_paint_t* paint, display_stops_t* stops, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color)
+{
+    const otfsvg_gradient_stop_t* resolved = tables->stops + entry->colors;
+    if(entry->dynamic) {
+        stops->size = 0;
+        otfsvg_array_ensure((*stops), (int)(entry->count));
+        for(uint32_t i = 0; i < entry->count; i++) {
+            const display_color_t* color = &tables->colors[entry->colors + i];
+            color_source_t source;
+            source.color.type = color->type;
+            source.color.value = color->value;
+            source.palette.data = NULL;
+            source.palette.length = color->length;
+            source.opacity = color->opacity;
+            if(color->palette)
+                source.palette.data = tables->strings + color->palette - 1;
+            stops->data[i].offset = resolved[i].offset;
+            stops->data[i].color = source_color(&source, current_color, palette_func, palette_data);
+        }
+
+        resolved = stops->data;
+    }
+
+    paint->type = entry->type;
+    if(entry->type == otfsvg_paint_type_color) {
+        paint->color = resolved[0].color;
+        return;
+    }
+
+    otfsvg_gradient_t* gradient = &paint->gradient;
+    gradient->type = entry->gradienttype;
+    gradient->spread = entry->spread;
+    gradient->matrix = entry->matrix;
+    gradient->x1 = entry->x1;
+    gradient->y1 = entry->y1;
+    gradient->x2 = entry->x2;
+    gradient->y2 = entry->y2;
+    gradient->cx = entry->cx;
+    gradient->cy = entry->cy;
+    gradient->r = entry->r;
+    gradient->fx = entry->fx;
+    gradient->fy = entry->fy;
+    gradient->stops.data = (otfsvg_gradient_stop_t*)(resolved);
+    gradient->stops.size = entry->count;
+    gradient->stops.capacity = entry->count;
+}
+
+static void display_tables_replay(const display_tables_t* tables, const otfsvg_matrix_t* matrix, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color)
+{
+    display_stops_t stops;
+    otfsvg_array_init(stops);
+    for(uint32_t i = 0; i < tables->count[display_table_commands]; i++) {
+        const display_command_t* command = &tables->commands[i];
+        switch(command->type) {
+        case display_command_fill:
+        case display_command_stroke: {
+            const display_path_t* entry = &tables->paths[command->path];
+            otfsvg_path_t path;
+            path.commands.data = (otfsvg_path_command_t*)(tables->pathcommands + entry->commands);
+            path.commands.size = path.commands.capacity = entry->commandcount;
+            path.points.data = (otfsvg_point_t*)(tables->points + entry->points);
+            path.points.size = path.points.capacity = entry->pointcount;
+
+            otfsvg_paint_t paint;
+            otfsvg_matrix_t transform;
+            display_tables_paint(tables, &tables->paints[command->paint], &paint, &stops, palette_func, palette_data, current_color);
+            otfsvg_matrix_multiply(&transform, &command->matrix, matrix);
+            if(command->type == display_command_fill) {
+                if(canvas->fill_path)
+                    canvas->fill_path(canvas_data, &path, &transform, command->mode, &paint);
+                break;
+            }
+
+            const display_stroke_t* stroke = &tables->strokes[command->stroke];
+            otfsvg_stroke_data_t strokedata;
+            strokedata.linecap = stroke->linecap;
+            strokedata.linejoin = stroke->linejoin;
+            strokedata.linewidth = stroke->linewidth;
+            strokedata.miterlimit = stroke->miterlimit;
+            strokedata.dashoffset = stroke->dashoffset;
+            strokedata.dasharray.data = (float*)(tables->dashes + stroke->dashes);
+            strokedata.dasharray.size = strokedata.dasharray.capacity = stroke->dashcount;
+            if(canvas->stroke_path)
+                canvas->stroke_path(canvas_data, &path, &transform, &strokedata, &paint);
+            break;
+        }
+
+        case display_command_push_group:
+            if(canvas->push_group)
+                canvas->push_group(canvas_data, command->opacity, command->mode);
+            break;
+        case display_command_pop_group:
+            if(canvas->pop_group)
+                canvas->pop_group(canvas_data, command->opacity, command->mode);
+            break;
+        }
+    }
+
+    otfsvg_array_destroy(stops);
+}
+
+bool otfsvg_display_list_replay(const otfsvg_display_list_t* list, const otfsvg_matrix_t* matrix, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color)
+{
+    display_tables_t tables;
+    display_list_tables(list, &tables);
+    display_tables_replay(&tables, matrix ? matrix : &list->matrix, canvas, canvas_data, palette_func, palette_data, current_color);
+    return true;
+}
+
+typedef struct {
+    int priority;
+    int index;
+} render_order_t;
+
+static int render_order_compare(const void* a, const void* b)
+{
+    const render_order_t* oa = a;
+    const render_order_t* ob = b;
+    if(oa->priority != ob->priority)
+        return (oa->priority > ob->priority) ? -1 : 1;
+    return oa->index - ob->index;
+}
+
+static bool render_pool_sort(render_order_t** order, int* capacity, const otfsvg_render_job_t* jobs, int count)
+{
+    if(*capacity < count) {
+        render_order_t* data = realloc(*order, count * sizeof(render_order_t));
+        if(data == NULL)
+            return false;
+        *order = data;
+        *capacity = count;
+    }
+
+    for(int i = 0; i < count; i++) {
+        (*order)[i].priority = jobs[i].priority;
+        (*order)[i].index = i;
+    }
+
+    qsort(*order, count, sizeof(render_order_t), render_order_compare);
+    return true;
+}
+
+static bool render_job_run(otfsvg_render_context_t* context, otfsvg_render_job_t* job)
+{
+    job->result = otfsvg_render_context_render_glyph(context, job->document, job->matrix, job->canvas, job->canvas_data, job->palette_func, job->palette_data, job->current_color, job->glyph);
+    return job->result;
+}
+
+#ifdef _WIN32
+struct otfsvg_render_pool {
+    otfsvg_render_context_t* context;
+    render_order_t* order;
+    int capacity;
+};
+
+otfsvg_render_pool_t* otfsvg_render_pool_create(int threads)
+{
+    (void)threads;
+    otfsvg_render_pool_t* pool = malloc(sizeof(otfsvg_render_pool_t));
+    pool->context = otfsvg_render_context_create();
+    pool->order = NULL;
+    pool->capacity = 0;
+    return pool;
+}
+
+void otfsvg_render_pool_destroy(otfsvg_render_pool_t* pool)
+{
+    otfsvg_render_context_destroy(pool->context);
+    free(pool->order);
+    free(pool);
+}
+
+bool otfsvg_render_pool_run(otfsvg_render_pool_t* pool, otfsvg_render_job_t* jobs, int count)
+{
+    if(count <= 0)
+        return true;
+    if(!render_pool_sort(&pool->order, &pool->capacity, jobs, count))
+        return false;
+    bool success = true;
+    for(int i = 0; i < count; i++)
+        success &= render_job_run(pool->context, &jobs[pool->order[i].index]);
+    return success;
+}
+#else
+typedef struct {
+    pthread_mutex_t mutex;
+    int* data;
+    int head;
+    int size;
+    int capacity;
+} render_queue_t;
+
+typedef struct {
+    otfsvg_render_pool_t* pool;
+    otfsvg_render_context_t* context;
+    render_queue_t queue;
+    pthread_t thread;
+} render_worker_t;
+
+struct otfsvg_render_pool {
+    render_worker_t* workers;
+    int count;
+    pthread_mutex_t batch;
+    pthread_mutex_t mutex;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    otfsvg_render_job_t* jobs;
+    render_order_t* order;
+    int capacity;
+    int active;
+    int failed;
+    unsigned generation;
+    bool quit;
+};
+
+static int render_queue_pop(render_queue_t* queue)
+{
+    int index = -1;
+    pthread_mutex_lock(&queue->mutex);
+    if(queue->head < queue->size)
+        index = queue->data[queue->head++];
+    pthread_mutex_unlock(&queue->mutex);
+    return index;
+}
+
+static bool render_queue_peek(render_queue_t* queue, const otfsvg_render_job_t* jobs, int* priority)
+{
+    pthread_mutex_lock(&queue->mutex);
+    bool empty = queue->head == queue->size;
+    if(!empty)
+        *priority = jobs[queue->data[queue->head]].priority;
+    pthread_mutex_unlock(&queue->mutex);
+    return !empty;
+}
+
+static int render_pool_steal(otfsvg_render_pool_t* pool, render_worker_t* thief)
+{
+    for(;;) {
+        render_worker_t* victim = NULL;
+        int best = 0;
+        for(int i = 0; i < pool->count; i++) {
+            render_worker_t* worker = &pool->workers[i];
+            int priority;
+            if(worker != thief && render_queue_peek(&worker->queue, pool->jobs, &priority) && (victim == NULL || priority > best)) {
+                victim = worker;
+                best = priority;
             }
+        }
 
-            if(skip_string(&it, end, "[CDATA[")) {
-                const char* begin = string_find(it, end, "]]>");
-                if(begin == NULL)
-                    break;
-                it = begin + 3;
-                skip_ws(&it, end);
-                continue;
-            }
+        if(victim == NULL)
+            return -1;
+        int index = render_queue_pop(&victim->queue);
+        if(index != -1) {
+            return index;
+        }
+    }
+}
 
-            if(skip_string(&it, end, "DOCTYPE")) {
-                while(it < end && *it != '>') {
-                    if(*it == '[') {
-                        ++it;
-                        int depth = 1;
-                        while(it < end && depth > 0) {
-                            if(*it == '[') ++depth;
-                            else if(*it == ']') --depth;
-                            ++it;
-                        }
-                    } else {
-                        ++it;
-                    }
-                }
+static void* render_worker_main(void* arg)
+{
+    render_worker_t* worker = arg;
+    otfsvg_render_pool_t* pool = worker->pool;
+    unsigned generation = 0;
+    for(;;) {
+        pthread_mutex_lock(&pool->mutex);
+        while(!pool->quit && pool->generation == generation)
+            pthread_cond_wait(&pool->start, &pool->mutex);
+        generation = pool->generation;
+        bool quit = pool->quit;
+        pthread_mutex_unlock(&pool->mutex);
+        if(quit) {
+            break;
+        }
 
-                if(it >= end || *it != '>')
-                    break;
-                it += 1;
-                skip_ws(&it, end);
-                continue;
+        int failed = 0;
+        for(;;) {
+            int index = render_queue_pop(&worker->queue);
+            if(index == -1)
+                index = render_pool_steal(pool, worker);
+            if(index == -1)
+                break;
+            if(!render_job_run(worker->context, &pool->jobs[index])) {
+                failed += 1;
             }
+        }
 
+        pthread_mutex_lock(&pool->mutex);
+        pool->failed += failed;
+        if(--pool->active == 0)
+            pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    return NULL;
+}
+
+otfsvg_render_pool_t* otfsvg_render_pool_create(int threads)
+{
+    if(threads <= 0)
+        threads = (int)(sysconf(_SC_NPROCESSORS_ONLN));
+    if(threads <= 0) {
+        threads = 1;
+    }
+
+    otfsvg_render_pool_t* pool = malloc(sizeof(otfsvg_render_pool_t));
+    pool->workers = malloc(threads * sizeof(render_worker_t));
+    pool->count = 0;
+    pthread_mutex_init(&pool->batch, NULL);
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->jobs = NULL;
+    pool->order = NULL;
+    pool->capacity = 0;
+    pool->active = 0;
+    pool->failed = 0;
+    pool->generation = 0;
+    pool->quit = false;
+    for(int i = 0; i < threads; i++) {
+        render_worker_t* worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->context = otfsvg_render_context_create();
+        pthread_mutex_init(&worker->queue.mutex, NULL);
+        worker->queue.data = NULL;
+        worker->queue.head = 0;
+        worker->queue.size = 0;
+        worker->queue.capacity = 0;
+        if(pthread_create(&worker->thread, NULL, render_worker_main, worker) != 0) {
+            pthread_mutex_destroy(&worker->queue.mutex);
+            otfsvg_render_context_destroy(worker->context);
             break;
         }
 
-        if(it >= end || !IS_STARTNAMECHAR(*it))
-            break;
+        pool->count += 1;
+    }
 
-        const char* begin = it;
-        ++it;
-        while(it < end && IS_NAMECHAR(*it))
-            ++it;
+    if(pool->count == 0) {
+        otfsvg_render_pool_destroy(pool);
+        return NULL;
+    }
 
-        element_t* element = NULL;
-        if(ignoring > 0) {
-            ++ignoring;
-        } else {
-            int id = elementid(begin, it - begin);
-            if(id == TAG_UNKNOWN) {
-                ignoring = 1;
-            } else {
-                if(document->root && current == NULL)
-                    break;
-                element = heap_alloc(document->heap, sizeof(element_t));
-                element->id = id;
-                element->parent = NULL;
-                element->nextchild = NULL;
-                element->firstchild = NULL;
-                element->lastchild = NULL;
-                element->property = NULL;
-                if(document->root == NULL) {
-                    if(element->id != TAG_SVG)
-                        break;
-                    document->root = element;
-                } else {
-                    element->parent = current;
-                    if(current->lastchild) {
-                        current->lastchild->nextchild = element;
-                        current->lastchild = element;
-                    } else {
-                        current->lastchild = element;
-                        current->firstchild = element;
-                    }
-                }
+    return pool;
+}
+
+void otfsvg_render_pool_destroy(otfsvg_render_pool_t* pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+    for(int i = 0; i < pool->count; i++) {
+        render_worker_t* worker = &pool->workers[i];
+        pthread_join(worker->thread, NULL);
+        pthread_mutex_destroy(&worker->queue.mutex);
+        otfsvg_render_context_destroy(worker->context);
+        free(worker->queue.data);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_mutex_destroy(&pool->batch);
+    free(pool->workers);
+    free(pool->order);
+    free(pool);
+}
+
+bool otfsvg_render_pool_run(otfsvg_render_pool_t* pool, otfsvg_render_job_t* jobs, int count)
+{
+    if(count <= 0)
+        return true;
+    pthread_mutex_lock(&pool->batch);
+    if(!render_pool_sort(&pool->order, &pool->capacity, jobs, count)) {
+        pthread_mutex_unlock(&pool->batch);
+        return false;
+    }
+
+    int share = (count + pool->count - 1) / pool->count;
+    for(int i = 0; i < pool->count; i++) {
+        render_queue_t* queue = &pool->workers[i].queue;
+        if(queue->capacity < share) {
+            int* data = realloc(queue->data, share * sizeof(int));
+            if(data == NULL) {
+                pthread_mutex_unlock(&pool->batch);
+                return false;
             }
+
+            queue->data = data;
+            queue->capacity = share;
         }
 
-        skip_ws(&it, end);
-        if(!parse_attributes(&it, end, document, element))
-            break;
+        queue->head = 0;
+        queue->size = 0;
+    }
 
-        if(it < end && *it == '>') {
-            if(element)
-                current = element;
-            ++it;
-            continue;
+    for(int i = 0; i < count; i++) {
+        render_queue_t* queue = &pool->workers[i % pool->count].queue;
+        queue->data[queue->size++] = pool->order[i].index;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->jobs = jobs;
+    pool->active = pool->count;
+    pool->failed = 0;
+    pool->generation += 1;
+    pthread_cond_broadcast(&pool->start);
+    while(pool->active > 0)
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    bool success = pool->failed == 0;
+    pool->jobs = NULL;
+    pthread_mutex_unlock(&pool->mutex);
+    pthread_mutex_unlock(&pool->batch);
+    return success;
+}
+#endif
+
+typedef struct {
+    uint16_t start_glyph;
+    uint16_t end_glyph;
+    uint32_t offset;
+    uint32_t length;
+    int document;
+} font_record_t;
+
+typedef struct {
+    otfsvg_document_t* document;
+    bool loaded;
+} font_document_t;
+
+struct otfsvg_font {
+    const char* data;
+    size_t length;
+    void* mapping;
+    const char* table;
+    size_t tablelength;
+    const char* index;
+    font_record_t* records;
+    font_document_t* documents;
+    int count;
+    int units_per_em;
+};
+
+static inline uint16_t read_u16(const char* data)
+{
+    const uint8_t* p = (const uint8_t*)(data);
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static inline uint32_t read_u32(const char* data)
+{
+    const uint8_t* p = (const uint8_t*)(data);
+    return (uint32_t)(p[0]) << 24 | (uint32_t)(p[1]) << 16 | (uint32_t)(p[2]) << 8 | (uint32_t)(p[3]);
+}
+
+#define TAG_SFNT(a, b, c, d) ((uint32_t)(a) << 24 | (uint32_t)(b) << 16 | (uint32_t)(c) << 8 | (uint32_t)(d))
+static bool find_table(const char* data, size_t length, uint32_t tag, size_t* offset, size_t* size)
+{
+    if(length < 12)
+        return false;
+    uint32_t version = read_u32(data);
+    if(version != 0x00010000 && version != TAG_SFNT('O', 'T', 'T', 'O') && version != TAG_SFNT('t', 'r', 'u', 'e'))
+        return false;
+
+    int count = read_u16(data + 4);
+    if(length < 12 + 16 * (size_t)(count))
+        return false;
+    const char* record = data + 12;
+    for(int i = 0; i < count; i++) {
+        if(read_u32(record) == tag) {
+            uint32_t tableoffset = read_u32(record + 8);
+            uint32_t tablelength = read_u32(record + 12);
+            if(tableoffset > length || tablelength > length - tableoffset)
+                return false;
+            *offset = tableoffset;
+            *size = tablelength;
+            return true;
         }
 
-        if(it < end && *it == '/') {
-            ++it;
-            if(it >= end || *it != '>')
-                break;
+        record += 16;
+    }
 
-            if(ignoring > 0)
-                --ignoring;
-            ++it;
-            continue;
+    return false;
+}
+
+static int font_record_compare(const void* a, const void* b)
+{
+    const font_record_t* first = *(const font_record_t* const*)(a);
+    const font_record_t* second = *(const font_record_t* const*)(b);
+    if(first->offset != second->offset)
+        return first->offset < second->offset ? -1 : 1;
+    return first < second ? -1 : first > second ? 1 : 0;
+}
+
+static font_document_t* font_assign_documents(font_record_t* records, int count)
+{
+    font_record_t** sorted = malloc((count > 0 ? count : 1) * sizeof(font_record_t*));
+    for(int i = 0; i < count; i++)
+        sorted[i] = &records[i];
+    qsort(sorted, count, sizeof(font_record_t*), font_record_compare);
+
+    int document = -1;
+    for(int i = 0; i < count; i++) {
+        if(i == 0 || sorted[i]->offset != sorted[i - 1]->offset)
+            ++document;
+        sorted[i]->document = document;
+    }
+
+    free(sorted);
+    return calloc(count > 0 ? count : 1, sizeof(font_document_t));
+}
+
+static otfsvg_font_t* font_create(const char* data, size_t length, size_t tableoffset, size_t tablelength)
+{
+    const char* table = data + tableoffset;
+    if(tablelength < 10 || read_u16(table) != 0)
+        return NULL;
+    uint32_t indexoffset = read_u32(table + 2);
+    if(indexoffset > tablelength - 2)
+        return NULL;
+
+    const char* index = table + indexoffset;
+    size_t indexlength = tablelength - indexoffset;
+    int count = read_u16(index);
+    if(indexlength < 2 + 12 * (size_t)(count))
+        return NULL;
+
+    font_record_t* records = malloc((count > 0 ? count : 1) * sizeof(font_record_t));
+    const char* entry = index + 2;
+    for(int i = 0; i < count; i++) {
+        font_record_t* record = &records[i];
+        record->start_glyph = read_u16(entry);
+        record->end_glyph = read_u16(entry + 2);
+        record->offset = read_u32(entry + 4);
+        record->length = read_u32(entry + 8);
+        if(record->start_glyph > record->end_glyph
+            || (i > 0 && record->start_glyph <= records[i - 1].end_glyph)
+            || record->length == 0 || record->offset > indexlength
+            || record->length > indexlength - record->offset) {
+            free(records);
+            return NULL;
         }
 
-        break;
+        entry += 12;
     }
 
-    skip_ws(&it, end);
-    if(document->root == NULL || it != end || ignoring != 0) {
-        otfsvg_document_clear(document);
-        return false;
+    otfsvg_font_t* font = malloc(sizeof(otfsvg_font_t));
+    font->data = data;
+    font->length = length;
+    font->mapping = NULL;
+    font->table = table;
+    font->tablelength = tablelength;
+    font->index = index;
+    font->records = records;
+    font->documents = font_assign_documents(records, count);
+    font->count = count;
+    font->units_per_em = 1000;
+    if(find_table(data, length, TAG_SFNT('h', 'e', 'a', 'd'), &tableoffset, &tablelength) && tablelength >= 20) {
+        int units_per_em = read_u16(data + tableoffset + 18);
+        if(units_per_em > 0) {
+            font->units_per_em = units_per_em;
+        }
     }
 
-    length_t w = {100, length_type_percent};
-    length_t h = {100, length_type_percent};
+    return font;
+}
 
-    parse_length(document->root, ID_WIDTH, &w, false, false);
-    parse_length(document->root, ID_HEIGHT, &h, false, false);
+otfsvg_font_t* otfsvg_font_create(const char* data, size_t length)
+{
+    size_t tableoffset = 0;
+    size_t tablelength = 0;
+    if(!find_table(data, length, TAG_SFNT('S', 'V', 'G', ' '), &tableoffset, &tablelength))
+        return NULL;
+    return font_create(data, length, tableoffset, tablelength);
+}
 
-    otfsvg_rect_t rect = {0, 0, width, height};
-    parse_view_box(document->root, ID_VIEWBOX, &rect);
+void otfsvg_font_destroy(otfsvg_font_t* font)
+{
+    for(int i = 0; i < font->count; i++) {
+        otfsvg_document_t* document = font->documents[i].document;
+        if(document) {
+            otfsvg_document_destory(document);
+        }
+    }
 
-    document->width = convert_length(&w, rect.w, dpi);
-    document->height = convert_length(&h, rect.h, dpi);
-    document->dpi = dpi;
-    return true;
+    free(font->documents);
+    free(font->records);
+    if(font->mapping) {
+#ifdef _WIN32
+        free(font->mapping);
+#else
+        munmap(font->mapping, font->length);
+#endif
+    }
+
+    free(font);
 }
 
-float otfsvg_document_width(const otfsvg_document_t* document)
+#ifdef _WIN32
+otfsvg_font_t* otfsvg_font_load_from_file(const char* filename)
 {
-    return document->width;
+    FILE* fp = fopen(filename, "rb");
+    if(fp == NULL)
+        return NULL;
+
+    fseek(fp, 0, SEEK_END);
+    long length = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    char* data = NULL;
+    otfsvg_font_t* font = NULL;
+    if(length > 0 && (data = malloc(length)) && fread(data, length, 1, fp) == 1)
+        font = otfsvg_font_create(data, length);
+    fclose(fp);
+    if(font == NULL) {
+        free(data);
+        return NULL;
+    }
+
+    font->mapping = data;
+    return font;
+}
+#else
+static void font_advise(char* mapping, size_t length, size_t offset, size_t size, int advice)
+{
+    size_t pagesize = (size_t)(sysconf(_SC_PAGESIZE));
+    size_t begin = offset & ~(pagesize - 1);
+    size_t end = otfsvg_min(offset + size, length);
+    if(begin < end) {
+        madvise(mapping + begin, end - begin, advice);
+    }
 }
 
-float otfsvg_document_height(const otfsvg_document_t* document)
+otfsvg_font_t* otfsvg_font_load_from_file(const char* filename)
 {
-    return document->height;
+    int fd = open(filename, O_RDONLY);
+    if(fd == -1)
+        return NULL;
+
+    struct stat st;
+    if(fstat(fd, &st) == -1 || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t length = (size_t)(st.st_size);
+    char* mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+        return NULL;
+
+    size_t tableoffset = 0;
+    size_t tablelength = 0;
+    if(!find_table(mapping, length, TAG_SFNT('S', 'V', 'G', ' '), &tableoffset, &tablelength)) {
+        munmap(mapping, length);
+        return NULL;
+    }
+
+    font_advise(mapping, length, 0, 12 + 16 * (size_t)(read_u16(mapping + 4)), MADV_RANDOM);
+    font_advise(mapping, length, tableoffset, tablelength, MADV_WILLNEED);
+    otfsvg_font_t* font = font_create(mapping, length, tableoffset, tablelength);
+    if(font == NULL) {
+        munmap(mapping, length);
+        return NULL;
+    }
+
+    font->mapping = mapping;
+    return font;
 }
+#endif
 
-void otfsvg_document_set_matrix(otfsvg_document_t* document, const otfsvg_matrix_t* matrix)
+int otfsvg_font_units_per_em(const otfsvg_font_t* font)
 {
-    document->matrix = *matrix;
+    return font->units_per_em;
 }
 
-void otfsvg_document_get_matrix(const otfsvg_document_t* document, otfsvg_matrix_t* matrix)
+int otfsvg_font_document_count(const otfsvg_font_t* font)
 {
-    *matrix = document->matrix;
+    return font->count;
 }
 
-bool otfsvg_document_render(otfsvg_document_t* document, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, const char* id)
+static void font_get_record(const otfsvg_font_t* font, const font_record_t* entry, otfsvg_document_record_t* record)
 {
-    if(document->root == NULL)
+    record->start_glyph = entry->start_glyph;
+    record->end_glyph = entry->end_glyph;
+    record->data = font->index + entry->offset;
+    record->length = entry->length;
+}
+
+bool otfsvg_font_document_at(const otfsvg_font_t* font, int index, otfsvg_document_record_t* record)
+{
+    if(index < 0 || index >= font->count)
         return false;
-    document->canvas = canvas;
-    document->canvas_data = canvas_data;
-    document->palette_func = palette_func;
-    document->palette_data = palette_data;
-    document->current_color = current_color;
+    font_get_record(font, &font->records[index], record);
+    return true;
+}
 
-    render_state_t state;
-    state.mode = render_mode_display;
-    state.matrix = document->matrix;
-    otfsvg_rect_init(&state.bbox, FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX);
-    if(id == NULL) {
-        state.element = document->root;
-        render_svg(document, &state, state.element);
-    } else {
-        string_t name = {id, strlen(id)};
-        element_t* element = find_element(document, &name);
-        if(element == NULL)
+static const font_record_t* font_find_record(const otfsvg_font_t* font, uint16_t glyph)
+{
+    int lo = 0;
+    int hi = font->count - 1;
+    while(lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        const font_record_t* entry = &font->records[mid];
+        if(glyph < entry->start_glyph)
+            hi = mid - 1;
+        else if(glyph > entry->end_glyph)
+            lo = mid + 1;
+        else
+            return entry;
+    }
+
+    return NULL;
+}
+
+bool otfsvg_font_find_document(const otfsvg_font_t* font, uint16_t glyph, otfsvg_document_record_t* record)
+{
+    const font_record_t* entry = font_find_record(font, glyph);
+    if(entry == NULL)
+        return false;
+    font_get_record(font, entry, record);
+    return true;
+}
+
+otfsvg_document_t* otfsvg_font_load_document(otfsvg_font_t* font, uint16_t glyph)
+{
+    const font_record_t* entry = font_find_record(font, glyph);
+    if(entry == NULL)
+        return NULL;
+
+    font_document_t* cache = &font->documents[entry->document];
+    if(!cache->loaded) {
+        float size = (float)(font->units_per_em);
+        otfsvg_document_t* document = otfsvg_document_create();
+        if(otfsvg_document_load_lazy(document, font->index + entry->offset, entry->length, size, size, 96.f)) {
+            cache->document = document;
+        } else {
+            otfsvg_document_destory(document);
+        }
+
+        cache->loaded = true;
+    }
+
+    return cache->document;
+}
+
+/*
+ * A glyph cache file holds the display list of every glyph of a font as the raw tables of the list, so that glyphs are
+ * replayed in place from a read-only mapping. The file is written in host byte order and structure layout: its header
+ * carries a version, a byte order mark and a hash of the `SVG ` table, and a file that does not match the library or
+ * the font is rejected as a whole. The tables of a glyph are checked before every replay rather than when the file is
+ * opened, so opening a cache only reads its header and glyph directory.
+ */
+#define GLYPH_CACHE_MAGIC "OTFSVGC"
+#define GLYPH_CACHE_VERSION 1
+#define GLYPH_CACHE_BYTE_ORDER 0x01020304
+#define GLYPH_CACHE_ALIGN(size) (((size) + 7) & ~(uint64_t)(7))
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteorder;
+    uint64_t key;
+    uint64_t length;
+    uint64_t glyphs;
+    uint32_t count;
+    uint32_t entrysize;
+} glyph_cache_header_t;
+
+typedef struct {
+    uint32_t glyph;
+    uint32_t reserved;
+    uint64_t offset;
+    otfsvg_matrix_t matrix;
+    otfsvg_rect_t bbox;
+    uint32_t count[display_table_count];
+} glyph_cache_entry_t;
+
+struct otfsvg_glyph_cache {
+    const char* data;
+    size_t length;
+    void* mapping;
+    const glyph_cache_entry_t* entries;
+    int count;
+};
+
+static bool glyph_cache_write_tables(FILE* fp, const display_tables_t* tables, uint64_t* offset)
+{
+    static const char padding[8] = {0};
+    const void* data[display_table_count] = {
+        tables->commands,
+        tables->paths,
+        tables->pathcommands,
+        tables->points,
+        tables->paints,
+        tables->colors,
+        tables->stops,
+        tables->strokes,
+        tables->dashes,
+        tables->strings
+    };
+
+    for(int i = 0; i < display_table_count; i++) {
+        uint64_t size = (uint64_t)(tables->count[i]) * display_table_sizes[i];
+        uint64_t aligned = GLYPH_CACHE_ALIGN(size);
+        if(size > 0 && fwrite(data[i], size, 1, fp) != 1)
+            return false;
+        if(aligned > size && fwrite(padding, aligned - size, 1, fp) != 1)
             return false;
-        state.element = element;
-        render_element(document, &state, state.element);
+        *offset += aligned;
     }
 
     return true;
 }
 
-bool otfsvg_document_rect(otfsvg_document_t* document, otfsvg_rect_t* rect, const char* id)
+static bool glyph_cache_write(FILE* fp, void* data)
 {
-    otfsvg_rect_init(rect, 0, 0, 0, 0);
-    if(document->root == NULL)
+    otfsvg_font_t* font = data;
+    glyph_cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    if(fwrite(&header, sizeof(header), 1, fp) != 1)
         return false;
-    document->canvas = NULL;
-    document->canvas_data = NULL;
-    document->palette_func = NULL;
-    document->palette_data = NULL;
-    document->current_color = otfsvg_black_color;
 
-    render_state_t state;
-    state.mode = render_mode_bounding;
-    state.matrix = document->matrix;
-    otfsvg_rect_init(&state.bbox, FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX);
-    if(id == NULL) {
-        state.element = document->root;
-        render_svg(document, &state, state.element);
-    } else {
-        string_t name = {id, strlen(id)};
-        element_t* element = find_element(document, &name);
-        if(element == NULL)
+    struct {
+        glyph_cache_entry_t* data;
+        int size;
+        int capacity;
+    } entries;
+
+    otfsvg_array_init(entries);
+    uint64_t offset = sizeof(header);
+    bool success = true;
+    for(int i = 0; i < font->count && success; i++) {
+        const font_record_t* record = &font->records[i];
+        for(uint32_t glyph = record->start_glyph; glyph <= record->end_glyph && success; glyph++) {
+            otfsvg_document_t* document = otfsvg_font_load_document(font, glyph);
+            otfsvg_display_list_t* list = document ? otfsvg_display_list_create_glyph(document, glyph) : NULL;
+            if(list == NULL)
+                continue;
+            display_tables_t tables;
+            display_list_tables(list, &tables);
+            otfsvg_array_ensure(entries, 1);
+            glyph_cache_entry_t* entry = &entries.data[entries.size++];
+            memset(entry, 0, sizeof(glyph_cache_entry_t));
+            entry->glyph = glyph;
+            entry->offset = offset;
+            entry->matrix = list->matrix;
+            entry->bbox = list->bbox;
+            memcpy(entry->count, tables.count, sizeof(entry->count));
+            success = glyph_cache_write_tables(fp, &tables, &offset);
+            otfsvg_display_list_destroy(list);
+        }
+    }
+
+    if(success && entries.size > 0)
+        success = fwrite(entries.data, sizeof(glyph_cache_entry_t), entries.size, fp) == (size_t)(entries.size);
+    if(success) {
+        memcpy(header.magic, GLYPH_CACHE_MAGIC, sizeof(header.magic));
+        header.version = GLYPH_CACHE_VERSION;
+        header.byteorder = GLYPH_CACHE_BYTE_ORDER;
+        header.key = content_hash(font->table, font->tablelength);
+        header.glyphs = offset;
+        header.count = entries.size;
+        header.entrysize = sizeof(glyph_cache_entry_t);
+        header.length = offset + entries.size * sizeof(glyph_cache_entry_t);
+        success = fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1;
+    }
+
+    otfsvg_array_destroy(entries);
+    return success;
+}
+
+bool otfsvg_glyph_cache_write(otfsvg_font_t* font, const char* filename)
+{
+    return replace_file(filename, glyph_cache_write, font);
+}
+
+otfsvg_glyph_cache_t* otfsvg_glyph_cache_create(const char* data, size_t length, const otfsvg_font_t* font)
+{
+    if(length < sizeof(glyph_cache_header_t) || (uintptr_t)(data) % 8 != 0)
+        return NULL;
+
+    const glyph_cache_header_t* header = (const glyph_cache_header_t*)(data);
+    if(memcmp(header->magic, GLYPH_CACHE_MAGIC, sizeof(header->magic)) != 0
+        || header->version != GLYPH_CACHE_VERSION
+        || header->byteorder != GLYPH_CACHE_BYTE_ORDER
+        || header->entrysize != sizeof(glyph_cache_entry_t)
+        || header->length != length
+        || header->glyphs % 8 != 0 || header->glyphs > length
+        || header->count > (length - header->glyphs) / sizeof(glyph_cache_entry_t)) {
+        return NULL;
+    }
+
+    if(font && header->key != content_hash(font->table, font->tablelength))
+        return NULL;
+
+    otfsvg_glyph_cache_t* cache = malloc(sizeof(otfsvg_glyph_cache_t));
+    cache->data = data;
+    cache->length = length;
+    cache->mapping = NULL;
+    cache->entries = (const glyph_cache_entry_t*)(data + header->glyphs);
+    cache->count = header->count;
+    return cache;
+}
+
+void otfsvg_glyph_cache_destroy(otfsvg_glyph_cache_t* cache)
+{
+    if(cache->mapping) {
+#ifdef _WIN32
+        free(cache->mapping);
+#else
+        munmap(cache->mapping, cache->length);
+#endif
+    }
+
+    free(cache);
+}
+
+#ifdef _WIN32
+otfsvg_glyph_cache_t* otfsvg_glyph_cache_load_from_file(const char* filename, const otfsvg_font_t* font)
+{
+    FILE* fp = fopen(filename, "rb");
+    if(fp == NULL)
+        return NULL;
+
+    fseek(fp, 0, SEEK_END);
+    long length = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    char* data = NULL;
+    otfsvg_glyph_cache_t* cache = NULL;
+    if(length > 0 && (data = malloc(length)) && fread(data, length, 1, fp) == 1)
+        cache = otfsvg_glyph_cache_create(data, length, font);
+    fclose(fp);
+    if(cache == NULL) {
+        free(data);
+        return NULL;
+    }
+
+    cache->mapping = data;
+    return cache;
+}
+#else
+otfsvg_glyph_cache_t* otfsvg_glyph_cache_load_from_file(const char* filename, const otfsvg_font_t* font)
+{
+    int fd = open(filename, O_RDONLY);
+    if(fd == -1)
+        return NULL;
+
+    struct stat st;
+    if(fstat(fd, &st) == -1 || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t length = (size_t)(st.st_size);
+    char* mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+        return NULL;
+
+    otfsvg_glyph_cache_t* cache = otfsvg_glyph_cache_create(mapping, length, font);
+    if(cache == NULL) {
+        munmap(mapping, length);
+        return NULL;
+    }
+
+    font_advise(mapping, length, 0, length, MADV_RANDOM);
+    cache->mapping = mapping;
+    return cache;
+}
+#endif
+
+static const glyph_cache_entry_t* glyph_cache_find(const otfsvg_glyph_cache_t* cache, uint16_t glyph)
+{
+    int lo = 0;
+    int hi = cache->count - 1;
+    while(lo <= hi) {
+        int mid = lo + (hi - lo) / 2;
+        const glyph_cache_entry_t* entry = &cache->entries[mid];
+        if(glyph < entry->glyph)
+            hi = mid - 1;
+        else if(glyph > entry->glyph)
+            lo = mid + 1;
+        else
+            return entry;
+    }
+
+    return NULL;
+}
+
+static bool glyph_cache_tables(const otfsvg_glyph_cache_t* cache, const glyph_cache_entry_t* entry, display_tables_t* tables)
+{
+    const char* data[display_table_count];
+    uint64_t offset = entry->offset;
+    if(offset % 8 != 0)
+        return false;
+    for(int i = 0; i < display_table_count; i++) {
+        uint64_t size = (uint64_t)(entry->count[i]) * display_table_sizes[i];
+        if(offset > cache->length || size > cache->length - offset)
             return false;
-        state.element = element;
-        render_element(document, &state, state.element);
+        data[i] = cache->data + offset;
+        tables->count[i] = entry->count[i];
+        offset += GLYPH_CACHE_ALIGN(size);
     }
 
-    if(state.bbox.w >= 0 && state.bbox.h >= 0)
-        otfsvg_matrix_map_rect(&document->matrix, &state.bbox, rect);
+    tables->commands = (const display_command_t*)(data[display_table_commands]);
+    tables->paths = (const display_path_t*)(data[display_table_paths]);
+    tables->pathcommands = (const otfsvg_path_command_t*)(data[display_table_pathcommands]);
+    tables->points = (const otfsvg_point_t*)(data[display_table_points]);
+    tables->paints = (const display_paint_t*)(data[display_table_paints]);
+    tables->colors = (const display_color_t*)(data[display_table_colors]);
+    tables->stops = (const otfsvg_gradient_stop_t*)(data[display_table_stops]);
+    tables->strokes = (const display_stroke_t*)(data[display_table_strokes]);
+    tables->dashes = (const float*)(data[display_table_dashes]);
+    tables->strings = data[display_table_strings];
+    return display_tables_check(tables);
+}
+
+bool otfsvg_glyph_cache_rect_glyph(const otfsvg_glyph_cache_t* cache, const otfsvg_matrix_t* matrix, otfsvg_rect_t* rect, uint16_t glyph)
+{
+    otfsvg_rect_init(rect, 0, 0, 0, 0);
+    const glyph_cache_entry_t* entry = glyph_cache_find(cache, glyph);
+    if(entry == NULL)
+        return false;
+    if(entry->bbox.w >= 0 && entry->bbox.h >= 0)
+        otfsvg_matrix_map_rect(matrix ? matrix : &entry->matrix, &entry->bbox, rect);
+    return true;
+}
+
+bool otfsvg_glyph_cache_render_glyph(const otfsvg_glyph_cache_t* cache, const otfsvg_matrix_t* matrix, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, uint16_t glyph)
+{
+    display_tables_t tables;
+    const glyph_cache_entry_t* entry = glyph_cache_find(cache, glyph);
+    if(entry == NULL || !glyph_cache_tables(cache, entry, &tables))
+        return false;
+    display_tables_replay(&tables, matrix ? matrix : &entry->matrix, canvas, canvas_data, palette_func, palette_data, current_color);
     return true;
 }
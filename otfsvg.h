@@ -242,7 +242,43 @@ otfsvg_document_t* otfsvg_document_create(void);
 void otfsvg_document_clear(otfsvg_document_t* document);
 void otfsvg_document_destory(otfsvg_document_t* document);
 
+/**
+ * Sets how many bytes of element storage a document keeps for reuse when it is cleared or loaded again.
+ * Storage above the limit is returned to the system; the default limit is 1 MiB.
+ **/
+void otfsvg_document_set_retain_limit(otfsvg_document_t* document, size_t limit);
+
 bool otfsvg_document_load(otfsvg_document_t* document, const char* data, size_t length, float width, float height, float dpi);
+
+/**
+ * Same as otfsvg_document_load, but only the root element is parsed up front; the children of the root are
+ * pre-scanned for their ids and byte ranges. The subtree of a child is parsed the first time it is rendered or
+ * measured, together with the subtrees it references.
+ **/
+bool otfsvg_document_load_lazy(otfsvg_document_t* document, const char* data, size_t length, float width, float height, float dpi);
+
+/**
+ * Writes the loaded document, fully parsed, as a position-independent image that otfsvg_document_load_image renders
+ * from in place. Property values stay offsets into the document text, which the image embeds only for gzip-compressed
+ * documents; otherwise the same text has to be supplied when the image is loaded.
+ * Images use the byte order and structure layout of the library that wrote them.
+ * @return true on success, otherwise false
+ **/
+bool otfsvg_document_write_image(const otfsvg_document_t* document, const char* filename);
+
+/**
+ * Loads a document from an image without parsing: the document renders straight from the image buffer, which is
+ * borrowed, must outlive the document and must be aligned to 8 bytes. The buffer is only read, so one read-only
+ * shared mapping can back documents in any number of processes. The source is the document text the image was
+ * written from and is ignored when the image embeds it. Returns false if the image is invalid or was written from
+ * a different text.
+ **/
+bool otfsvg_document_load_image(otfsvg_document_t* document, const char* data, size_t length, const char* source, size_t source_length);
+
+/**
+ * Same as otfsvg_document_load_image, over a shared read-only memory mapping of the file owned by the document.
+ **/
+bool otfsvg_document_load_image_from_file(otfsvg_document_t* document, const char* filename, const char* source, size_t source_length);
 float otfsvg_document_width(const otfsvg_document_t* document);
 float otfsvg_document_height(const otfsvg_document_t* document);
 void otfsvg_document_set_matrix(otfsvg_document_t* document, const otfsvg_matrix_t* matrix);
@@ -250,6 +286,239 @@ void otfsvg_document_get_matrix(const otfsvg_document_t* document, otfsvg_matrix
 bool otfsvg_document_rect(otfsvg_document_t* document, otfsvg_rect_t* rect, const char* id);
 bool otfsvg_document_render(otfsvg_document_t* document, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, const char* id);
 
+/**
+ * Glyph ID variants of otfsvg_document_rect and otfsvg_document_render.
+ * Elements with an id of the form `glyph<N>` are indexed by N at load time.
+ **/
+bool otfsvg_document_rect_glyph(otfsvg_document_t* document, otfsvg_rect_t* rect, uint16_t glyph);
+bool otfsvg_document_render_glyph(otfsvg_document_t* document, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, uint16_t glyph);
+
+/**
+ * Variants of otfsvg_document_render and otfsvg_document_render_glyph that only render what may intersect `clip`, a
+ * rectangle in output units: a shape, group or use whose bounds lie outside of it is skipped with its whole subtree.
+ * Rendering a large glyph tile by tile this way costs about as much as the content that shows in each tile.
+ **/
+bool otfsvg_document_render_clipped(otfsvg_document_t* document, const otfsvg_rect_t* clip, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, const char* id);
+bool otfsvg_document_render_glyph_clipped(otfsvg_document_t* document, const otfsvg_rect_t* clip, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, uint16_t glyph);
+
+/**
+ * otfsvg_glyph_position_t places one glyph of a run.
+ * The position is added to the translation of the document matrix, so it is expressed in output units.
+ **/
+typedef struct {
+    uint16_t glyph;
+    float x;
+    float y;
+} otfsvg_glyph_position_t;
+
+/**
+ * Renders a run of glyphs that share the canvas, palette and current color.
+ * Glyphs missing from the document are skipped.
+ * @return true if every glyph of the run was found, otherwise false
+ **/
+bool otfsvg_document_render_run(otfsvg_document_t* document, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, const otfsvg_glyph_position_t* glyphs, int count);
+
+/**
+ * otfsvg_index_t lists the elements of a document that carry an id without building the document tree.
+ * A document is indexed exactly when otfsvg_document_load would accept it.
+ * Entries are sorted by id; when an id is used more than once, lookups return the last element that carries it.
+ * @id: the id value, not null terminated
+ * @tag: the element name
+ * @offset: offset of the element start tag in the markup returned by otfsvg_index_data
+ * @length: length of the element, including its content and end tag
+ **/
+typedef struct {
+    const char* id;
+    size_t id_length;
+    const char* tag;
+    size_t offset;
+    size_t length;
+} otfsvg_index_entry_t;
+
+typedef struct otfsvg_index otfsvg_index_t;
+
+otfsvg_index_t* otfsvg_index_create(void);
+void otfsvg_index_clear(otfsvg_index_t* index);
+void otfsvg_index_destroy(otfsvg_index_t* index);
+
+bool otfsvg_index_load(otfsvg_index_t* index, const char* data, size_t length);
+
+/**
+ * Returns the indexed markup, which is the decompressed copy for gzip-compressed documents.
+ **/
+const char* otfsvg_index_data(const otfsvg_index_t* index, size_t* length);
+int otfsvg_index_count(const otfsvg_index_t* index);
+bool otfsvg_index_entry_at(const otfsvg_index_t* index, int at, otfsvg_index_entry_t* entry);
+bool otfsvg_index_find(const otfsvg_index_t* index, const char* id, otfsvg_index_entry_t* entry);
+bool otfsvg_index_find_glyph(const otfsvg_index_t* index, uint16_t glyph, otfsvg_index_entry_t* entry);
+
+/**
+ * otfsvg_render_context_t owns the scratch state of a render (path, paint, stroke data).
+ * A loaded document is never modified while rendering through a context, so one document can be
+ * rendered concurrently by several threads as long as each thread uses its own context.
+ * A NULL matrix selects the document matrix.
+ **/
+typedef struct otfsvg_render_context otfsvg_render_context_t;
+
+otfsvg_render_context_t* otfsvg_render_context_create(void);
+void otfsvg_render_context_destroy(otfsvg_render_context_t* context);
+
+bool otfsvg_render_context_rect(otfsvg_render_context_t* context, const otfsvg_document_t* document, const otfsvg_matrix_t* matrix, otfsvg_rect_t* rect, const char* id);
+bool otfsvg_render_context_rect_glyph(otfsvg_render_context_t* context, const otfsvg_document_t* document, const otfsvg_matrix_t* matrix, otfsvg_rect_t* rect, uint16_t glyph);
+bool otfsvg_render_context_render(otfsvg_render_context_t* context, const otfsvg_document_t* document, const otfsvg_matrix_t* matrix, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, const char* id);
+bool otfsvg_render_context_render_glyph(otfsvg_render_context_t* context, const otfsvg_document_t* document, const otfsvg_matrix_t* matrix, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, uint16_t glyph);
+bool otfsvg_render_context_render_run(otfsvg_render_context_t* context, const otfsvg_document_t* document, const otfsvg_matrix_t* matrix, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, const otfsvg_glyph_position_t* glyphs, int count);
+bool otfsvg_render_context_render_clipped(otfsvg_render_context_t* context, const otfsvg_document_t* document, const otfsvg_matrix_t* matrix, const otfsvg_rect_t* clip, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, const char* id);
+bool otfsvg_render_context_render_glyph_clipped(otfsvg_render_context_t* context, const otfsvg_document_t* document, const otfsvg_matrix_t* matrix, const otfsvg_rect_t* clip, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, uint16_t glyph);
+
+/**
+ * otfsvg_render_stats_t counts the compositing layers of the last render through a context.
+ * A group is only pushed when its opacity cannot be folded into what it paints, which is the case when its paints and
+ * nested layers overlap, and a group that paints nothing is not rendered at all.
+ * @layers: push_group calls, including those of clip paths
+ * @folded_layers: groups rendered without a layer, their opacity applied to their paints and nested layers
+ * @empty_layers: groups dropped because they paint nothing or are fully transparent
+ **/
+typedef struct {
+    int layers;
+    int folded_layers;
+    int empty_layers;
+} otfsvg_render_stats_t;
+
+void otfsvg_render_context_get_stats(const otfsvg_render_context_t* context, otfsvg_render_stats_t* stats);
+void otfsvg_document_get_stats(const otfsvg_document_t* document, otfsvg_render_stats_t* stats);
+
+/**
+ * otfsvg_display_list_t is a render of a document, or of one of its elements, compiled into a flat list of canvas
+ * calls with their geometry, paints and stroke data. Replaying it drives a canvas like the corresponding render does,
+ * without going through the document, and the list stays valid after the document is cleared or destroyed.
+ * Colors that depend on currentColor or on the palette are resolved on every replay.
+ * Which groups get a layer of their own is decided when the list is created and holds for every replay.
+ * A NULL matrix selects the document matrix at the time the list was created.
+ **/
+typedef struct otfsvg_display_list otfsvg_display_list_t;
+
+otfsvg_display_list_t* otfsvg_display_list_create(const otfsvg_document_t* document, const char* id);
+otfsvg_display_list_t* otfsvg_display_list_create_glyph(const otfsvg_document_t* document, uint16_t glyph);
+void otfsvg_display_list_destroy(otfsvg_display_list_t* list);
+
+bool otfsvg_display_list_rect(const otfsvg_display_list_t* list, const otfsvg_matrix_t* matrix, otfsvg_rect_t* rect);
+bool otfsvg_display_list_replay(const otfsvg_display_list_t* list, const otfsvg_matrix_t* matrix, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color);
+
+/**
+ * otfsvg_render_job_t describes one glyph render submitted to a render pool.
+ * Jobs with a higher priority are started before jobs with a lower priority.
+ * The canvas callbacks of a job are invoked from a worker thread, so canvas_data must not be shared between jobs
+ * unless the canvas is thread-safe. A NULL matrix selects the document matrix.
+ * @result: set to the return value of the render once the job has run
+ **/
+typedef struct {
+    const otfsvg_document_t* document;
+    uint16_t glyph;
+    const otfsvg_matrix_t* matrix;
+    otfsvg_canvas_t* canvas;
+    void* canvas_data;
+    otfsvg_palette_func_t palette_func;
+    void* palette_data;
+    otfsvg_color_t current_color;
+    int priority;
+    bool result;
+} otfsvg_render_job_t;
+
+/**
+ * otfsvg_render_pool_t runs batches of render jobs on a set of worker threads.
+ * Each worker owns a render context; idle workers steal queued jobs from busy ones.
+ * A thread count of zero or less selects the number of online processors.
+ * On Windows the pool has no worker threads: the thread count is ignored and jobs run serially, in priority order, on
+ * the calling thread.
+ **/
+typedef struct otfsvg_render_pool otfsvg_render_pool_t;
+
+otfsvg_render_pool_t* otfsvg_render_pool_create(int threads);
+void otfsvg_render_pool_destroy(otfsvg_render_pool_t* pool);
+
+/**
+ * Runs all jobs and blocks until they have completed.
+ * @return true if every job rendered successfully, otherwise false
+ **/
+bool otfsvg_render_pool_run(otfsvg_render_pool_t* pool, otfsvg_render_job_t* jobs, int count);
+
+/**
+ * otfsvg_document_record_t describes one SVGDocumentRecord of an OpenType `SVG ` table
+ * @start_glyph - first glyph ID covered by the document
+ * @end_glyph - last glyph ID covered by the document
+ * @data - pointer to the document bytes inside the font data (not copied)
+ * @length - length of the document in bytes
+ **/
+typedef struct {
+    uint16_t start_glyph;
+    uint16_t end_glyph;
+    const char* data;
+    size_t length;
+} otfsvg_document_record_t;
+
+typedef struct otfsvg_font otfsvg_font_t;
+
+/**
+ * Creates a font over a raw sfnt buffer, returns NULL if the font has no valid `SVG ` table.
+ * The buffer is borrowed and must outlive the font.
+ **/
+otfsvg_font_t* otfsvg_font_create(const char* data, size_t length);
+
+/**
+ * Creates a font over a read-only memory mapping of the file, returns NULL on failure.
+ * The mapping is owned by the font; documents loaded from it reference the mapped bytes directly.
+ **/
+otfsvg_font_t* otfsvg_font_load_from_file(const char* filename);
+void otfsvg_font_destroy(otfsvg_font_t* font);
+
+int otfsvg_font_document_count(const otfsvg_font_t* font);
+bool otfsvg_font_document_at(const otfsvg_font_t* font, int index, otfsvg_document_record_t* record);
+bool otfsvg_font_find_document(const otfsvg_font_t* font, uint16_t glyph, otfsvg_document_record_t* record);
+int otfsvg_font_units_per_em(const otfsvg_font_t* font);
+
+/**
+ * Returns the parsed document that contains the glyph, or NULL.
+ * Documents are loaded lazily on first use (see otfsvg_document_load_lazy), cached by document offset and shared by every glyph
+ * of their range records. The viewport is the em square (units per em at 96 dpi).
+ * The returned document is owned by the font.
+ * The font itself, including this call and its document cache, must be used from one thread at a time; only the
+ * documents it returns may be rendered concurrently, each thread through its own render context or a render pool.
+ **/
+otfsvg_document_t* otfsvg_font_load_document(otfsvg_font_t* font, uint16_t glyph);
+
+/**
+ * otfsvg_glyph_cache_t reads a glyph cache file, which stores the display list of every glyph of a font
+ * (see otfsvg_display_list_t) so that glyphs can be rendered from the file without loading any document.
+ * Files are tied to the `SVG ` table of the font they were written from and to the byte order and version of the
+ * library that wrote them; any other file is rejected when the cache is created.
+ * A NULL matrix selects the document matrix the glyph was compiled with.
+ **/
+typedef struct otfsvg_glyph_cache otfsvg_glyph_cache_t;
+
+/**
+ * Compiles every glyph of the font and writes the cache file. The file is written next to the destination and renamed
+ * over it once complete, so a reader never maps a partially written cache.
+ * @return true on success, otherwise false
+ **/
+bool otfsvg_glyph_cache_write(otfsvg_font_t* font, const char* filename);
+
+/**
+ * Creates a cache over the contents of a cache file, returns NULL if the data is not a valid cache or, when a font is
+ * given, if the cache was written from a different `SVG ` table. A NULL font skips that check.
+ * The buffer is borrowed, must outlive the cache and must be aligned to 8 bytes.
+ **/
+otfsvg_glyph_cache_t* otfsvg_glyph_cache_create(const char* data, size_t length, const otfsvg_font_t* font);
+
+/**
+ * Creates a cache over a read-only memory mapping of the file, returns NULL on failure.
+ **/
+otfsvg_glyph_cache_t* otfsvg_glyph_cache_load_from_file(const char* filename, const otfsvg_font_t* font);
+void otfsvg_glyph_cache_destroy(otfsvg_glyph_cache_t* cache);
+
+bool otfsvg_glyph_cache_rect_glyph(const otfsvg_glyph_cache_t* cache, const otfsvg_matrix_t* matrix, otfsvg_rect_t* rect, uint16_t glyph);
+bool otfsvg_glyph_cache_render_glyph(const otfsvg_glyph_cache_t* cache, const otfsvg_matrix_t* matrix, otfsvg_canvas_t* canvas, void* canvas_data, otfsvg_palette_func_t palette_func, void* palette_data, otfsvg_color_t current_color, uint16_t glyph);
+
 #ifdef __cplusplus
 }
 #endif
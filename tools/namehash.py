@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+#
+# Regenerates the minimal perfect-hash tables used by propertyid, elementid and
+# parse_color_value in otfsvg.c.
+#
+# The name tables themselves (propertymap, elementmap, colormap) are edited by
+# hand and stay sorted by name. After adding, removing or renaming an entry,
+# run this script from the repository root:
+#
+#     python3 tools/namehash.py [otfsvg.c]
+#
+# It fixes the length field of every entry and rewrites the <prefix>hash and
+# <prefix>slots arrays that follow each table. The hash here must match
+# name_slot in otfsvg.c.
+
+import re
+import sys
+
+TABLES = [
+    ("propertymap", "name_entry_t", "property"),
+    ("elementmap", "name_entry_t", "element"),
+    ("colormap", "color_entry_t", "color"),
+]
+
+MASK = 0xFFFFFFFF
+
+
+def name_hash(name):
+    hash = 0x811C9DC5 ^ len(name)
+    for ch in name.encode():
+        hash = ((hash ^ ch) * 0x01000193) & MASK
+    return hash
+
+
+def name_bucket(hash, count):
+    return (hash * count) >> 32
+
+
+def name_mix(hash, displacement, count):
+    x = (hash + displacement * 0x9E3779B1) & MASK
+    x ^= x >> 15
+    x = (x * 0x2C1B3C6D) & MASK
+    x ^= x >> 12
+    return (x * count) >> 32
+
+
+def build(table, names):
+    count = len(names)
+    if count > 256:
+        sys.exit("%s: more than 256 entries do not fit the uint8_t slot table" % table)
+    hashes = [name_hash(name) for name in names]
+    if len(set(hashes)) != count:
+        sys.exit("%s: two names share a hash; change the basis in name_slot and here" % table)
+
+    buckets = [[] for _ in range(count)]
+    for index, hash in enumerate(hashes):
+        buckets[name_bucket(hash, count)].append(index)
+
+    displacements = [0] * count
+    slots = [None] * count
+    for bucket in sorted(range(count), key=lambda b: -len(buckets[b])):
+        members = buckets[bucket]
+        if not members:
+            break
+        for displacement in range(256):
+            targets = [name_mix(hashes[i], displacement, count) for i in members]
+            if len(set(targets)) == len(targets) and all(slots[t] is None for t in targets):
+                break
+        else:
+            sys.exit("%s: no displacement below 256 separates bucket %d" % (table, bucket))
+        displacements[bucket] = displacement
+        for index, target in zip(members, targets):
+            slots[target] = index
+    return displacements, slots
+
+
+def format_array(name, values):
+    lines = []
+    for i in range(0, len(values), 16):
+        lines.append("    " + ", ".join("%d" % v for v in values[i:i + 16]))
+    return "static const uint8_t %s[%d] = {\n%s\n};\n" % (name, len(values), ",\n".join(lines))
+
+
+ENTRY = re.compile(r'\{"([^"]*)",\s*(?:\d+,\s*)?(\w+)\}')
+
+
+def regenerate(source, table, type, prefix):
+    header = re.search(r"static const %s %s\[\] = \{\n(.*?)\n\};\n" % (type, table), source, re.S)
+    if not header:
+        sys.exit("%s: table not found" % table)
+
+    entries = ENTRY.findall(header.group(1))
+    names = [name for name, _ in entries]
+    if names != sorted(names):
+        sys.exit("%s: entries must stay sorted by name" % table)
+
+    body = ",\n".join('    {"%s", %d, %s}' % (name, len(name), value) for name, value in entries)
+    displacements, slots = build(table, names)
+    generated = "static const %s %s[] = {\n%s\n};\n\n" % (type, table, body)
+    generated += "/* Generated by tools/namehash.py from %s. */\n" % table
+    generated += format_array(prefix + "hash", displacements)
+    generated += "\n"
+    generated += format_array(prefix + "slots", slots)
+
+    end = header.end()
+    existing = re.compile(r"\n/\* Generated by tools/namehash\.py from %s\. \*/\n"
+                          r"static const uint8_t %shash\[\d+\] = \{[^}]*\};\n\n"
+                          r"static const uint8_t %sslots\[\d+\] = \{[^}]*\};\n" % (table, prefix, prefix))
+    match = existing.match(source, end)
+    if match:
+        end = match.end()
+    return source[:header.start()] + generated + source[end:]
+
+
+def main():
+    path = sys.argv[1] if len(sys.argv) > 1 else "otfsvg.c"
+    with open(path) as file:
+        source = file.read()
+    for table, type, prefix in TABLES:
+        source = regenerate(source, table, type, prefix)
+    with open(path, "w") as file:
+        file.write(source)
+
+
+if __name__ == "__main__":
+    main()